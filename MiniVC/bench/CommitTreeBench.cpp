@@ -0,0 +1,1750 @@
+// Headless benchmark for the commit tree, runs outside Notepad++.
+//
+// Build (arena allocation, the default):
+//   cl /O2 /EHsc CommitTreeBench.cpp          or   g++ -O2 -std=c++14 -pthread CommitTreeBench.cpp -o bench
+// Build the per-node heap baseline for comparison:
+//   cl /O2 /EHsc /DMINIVC_HEAP_NODES ...      or   g++ -O2 -std=c++14 -DMINIVC_HEAP_NODES ...
+// Build with another number of mod slots per node field (3 by default):
+//   cl /O2 /EHsc /DMINIVC_MAX_MODS=5 ...      or   g++ -O2 -std=c++14 -DMINIVC_MAX_MODS=5 ...
+//
+// Usage: bench [pointer|indexed|policies|image|latency|btree|codec|io] [commitCount ...]   (defaults to pointer, 10000 100000 1000000)
+//        bench check [seeds]                                                                 (defaults to 50 seeds)
+//   pointer   the shared_ptr fat node tree from CommitTree.h
+//   indexed   the structure-of-arrays tree from IndexedCommitTree.h
+//   policies  PersistentTree.h once per persistence policy, then CommitHistory as built ("shipped"), in ns/op and node bytes per commit
+//   image     writes the tree to minivc_bench.img in the working directory, then maps it and queries it in place
+//   latency   sequential, random and rollback-heavy histories, latency percentiles per operation and memory.
+//             Counts up to 10M work, at about 2.6 KB per commit the larger ones need the memory for it
+//   btree     the AVL against the B+-tree from CommitBTree.h on the same commits, in order and shuffled:
+//             latency percentiles for as-of search, successor and iteration, node bytes per commit
+//   codec     BlockCodec.h on a generated source file of commitCount lines: ratio, compression and decompression MB/s,
+//             then the newest text read whole against rebuilt through a chain of 15 deltas
+//   io        FileIO.h on a file of commitCount KB in the working directory: 100-byte records written through stdio
+//             and through FileWriter, then read back through a 1 KB stream copy, readFile and a mapping, in MB/s
+//   check     randomized differential test of CommitHistory, its branches, IndexedCommitTree and CommitBTree against a std::map
+//             per version, of the timeline rows filtered to a time range, plus reader threads querying a CommitRepository
+//             while it is written, compacted and reset (build with -fsanitize=thread to catch races). Then the storage:
+//             an image read back version by version and refused when cut or damaged, an object pack reopened after
+//             folds and crashes and replayed, stored object and delta round trips. Its files, minivc_check.*, go to the
+//             working directory. Exits 1 on a mismatch. Run it before shipping a DLL built from changed tree or storage code
+// Run one count per process when comparing RSS, freed heap pages are not always returned to the OS.
+
+#include "../src/CommitTree.h"
+#include "../src/CommitRepository.h"
+#include "../src/IndexedCommitTree.h"
+#include "../src/PersistentTree.h"
+#include "../src/CommitImage.h"
+#include "../src/CommitBTree.h"
+#include "../src/BlockCodec.h"
+#include "../src/DeltaCodec.h"
+#include "../src/ObjectPack.h"
+#include "../src/HistoryLoad.h"
+#include "../src/FileIO.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <algorithm>
+#include <climits>
+#include <random>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <unistd.h>
+#endif
+
+
+// Resident set size of this process in bytes
+static size_t residentBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return pmc.WorkingSetSize;
+    return 0;
+#else
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (!fp)
+        return 0;
+    long pages = 0, resident = 0;
+    if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(fp);
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+// shared_ptr nodes from CommitTree.h
+struct PointerEngine {
+    CommitHistory history;
+
+    static const char* name() { return "pointer"; }
+    void insert(int commit, const std::wstring& file, const std::wstring& diff, const std::wstring& msg) {
+        history.insert(commit, file, diff, msg);
+    }
+    bool search(int commit, int version) const { return history.search(commit, version) != nullptr; }
+    int successor(int commit, int version) const {
+        auto node = history.successor(commit, version);
+        return node ? node->commitCounter : -1;
+    }
+    size_t nodeBytes() const { return history.nodeArena().bytesInUse(); }
+    void printCounters() const {
+        const TreeCounters& c = treeCounters();
+        printf("         payloads created %zu | payload copies %zu | node copies %zu | rotations %zu | mods logged %zu\n",
+            c.payloadsCreated, c.payloadCopies, c.nodeCopies, c.rotations, c.modsLogged);
+        MemoryReport report = history.memoryReport();
+        printf("         %zu nodes %zu B | %zu payloads %zu B | %.1f B/version | %.2f mod slots/node | %.2f rotations/insert\n",
+            report.nodes, report.nodeBytes, report.payloads, report.payloadBytes, report.bytesPerVersion(),
+            report.modSlotsPerNode(), c.inserts ? (double)c.rotations / c.inserts : 0.0);
+    }
+    void reset() {
+        history.clear();
+        treeCounters() = TreeCounters();
+    }
+};
+
+
+// index based nodes from IndexedCommitTree.h
+struct IndexedEngine {
+    IndexedCommitTree tree;
+
+    static const char* name() { return "indexed"; }
+    void insert(int commit, const std::wstring& file, const std::wstring& diff, const std::wstring& msg) {
+        tree.insertNode(commit, file, diff, msg);
+    }
+    bool search(int commit, int version) const { return tree.searchCommit(commit, version) != IndexedCommitTree::NIL; }
+    int successor(int commit, int version) const {
+        IndexedCommitTree::NodeIndex node = tree.getSuccessor(commit, version);
+        return node != IndexedCommitTree::NIL ? tree.commitOf(node) : -1;
+    }
+    size_t nodeBytes() const { return tree.bytesUsed(); }
+    void printCounters() const {}
+    void reset() { tree.clear(); }
+};
+
+
+template <class Engine>
+static void runWorkload(int commitCount) {
+    Engine engine;
+    size_t rssBefore = residentBytes();
+
+    // insert commits the way commitCurrentFile does, one version per commit
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 1; i <= commitCount; i++) {
+        engine.insert(i, L"commit_" + std::to_wstring(i) + L".txt",
+            L"Added: 4, Removed: 1", L"Commit message for revision " + std::to_wstring(i));
+    }
+    double insertSeconds = secondsSince(start);
+    size_t rssAfter = residentBytes();
+
+    // random point lookups at the newest version
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> pick(1, commitCount);
+    int found = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < commitCount; i++) {
+        if (engine.search(pick(rng), commitCount))
+            found++;
+    }
+    double searchSeconds = secondsSince(start);
+
+    // lookups against random historical versions, commit i is present from version i on
+    int agreed = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < commitCount; i++) {
+        int version = pick(rng);
+        int commit = pick(rng);
+        if (engine.search(commit, version) == (commit <= version))
+            agreed++;
+    }
+    double historySeconds = secondsSince(start);
+
+    // in-order walk through successor queries, what the viewer's Next button does
+    int walked = 0;
+    start = std::chrono::steady_clock::now();
+    for (int commit = engine.successor(0, commitCount); commit != -1; commit = engine.successor(commit, commitCount))
+        walked++;
+    double walkSeconds = secondsSince(start);
+
+    printf("%-8s %9d commits | insert %8.0f ops/s | search %10.0f ops/s | as-of search %10.0f ops/s | successor %10.0f ops/s | nodes %6.1f B/commit | RSS +%7.1f MB%s\n",
+        Engine::name(),
+        commitCount,
+        commitCount / insertSeconds,
+        commitCount / searchSeconds,
+        commitCount / historySeconds,
+        walked / walkSeconds,
+        (double)engine.nodeBytes() / commitCount,
+        (double)(rssAfter - rssBefore) / (1024.0 * 1024.0),
+        (found == commitCount && agreed == commitCount && walked == commitCount) ? "" : " (lookup mismatch)");
+    engine.printCounters();
+
+    engine.reset();
+}
+
+
+// repository load: commits arrive in directory order and go through CommitHistory::bulkLoad
+static void runBulkLoad(int commitCount) {
+    std::vector<CommitInfo> commits;
+    commits.reserve(commitCount);
+    for (int i = 1; i <= commitCount; i++) {
+        commits.push_back({ i, L"commit_" + std::to_wstring(i) + L".txt",
+            L"Added: 4, Removed: 1", L"Commit message for revision " + std::to_wstring(i), CommitStats{ 4, 1, 512 }, i, L"bench" });
+    }
+    std::shuffle(commits.begin(), commits.end(), std::mt19937(7));
+
+    CommitHistory history;
+    auto start = std::chrono::steady_clock::now();
+    int version = history.bulkLoad(std::move(commits));
+    double loadSeconds = secondsSince(start);
+    bool complete = history.search(1, version) && history.search(commitCount, version);
+
+    printf("%-8s %9d commits | bulk load %8.3f s (%.0f commits/s)%s\n",
+        "bulk", commitCount, loadSeconds, commitCount / loadSeconds, complete ? "" : " (lookup mismatch)");
+
+    history.clear();
+}
+
+
+// same insert, search, as-of search and full in-order iteration against one persistence policy
+template <class Policy>
+static void runPolicy(const char* label, int commitCount) {
+    typedef PersistentTree<int, CommitStats, Policy> Tree;
+    Tree tree;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 1; i <= commitCount; i++)
+        tree.insert(i, CommitStats{ 4, 1, 512 });
+    double insertSeconds = secondsSince(start);
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> pick(1, commitCount);
+    int found = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < commitCount; i++) {
+        if (tree.search(pick(rng), commitCount))
+            found++;
+    }
+    double searchSeconds = secondsSince(start);
+
+    int agreed = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < commitCount; i++) {
+        int version = pick(rng);
+        int commit = pick(rng);
+        if ((tree.search(commit, version) != nullptr) == (commit <= version))
+            agreed++;
+    }
+    double historySeconds = secondsSince(start);
+
+    long long visited = 0;
+    start = std::chrono::steady_clock::now();
+    tree.forEach(commitCount, [&](typename Tree::NodePtr node) { visited += tree.payloadOf(node).linesAdded; });
+    double iterateSeconds = secondsSince(start);
+
+    const double ns = 1e9 / commitCount;
+    printf("%-20s %9d commits | insert %7.1f ns/op | search %7.1f ns/op | as-of search %7.1f ns/op | iterate %6.1f ns/op | nodes %7.1f B/commit%s\n",
+        label, commitCount, insertSeconds * ns, searchSeconds * ns, historySeconds * ns, iterateSeconds * ns,
+        (double)tree.nodeBytes() / commitCount,
+        (found == commitCount && agreed == commitCount && visited == 4LL * commitCount) ? "" : " (lookup mismatch)");
+}
+
+
+// The same workload on the tree the plugin runs, so the policies can be read against it. Every
+// commit shares one payload kept outside the history's arena, the bytes are its nodes alone.
+// Its nodes also carry subtree sizes and stats, which the policy trees leave out
+static void runShippedTree(int commitCount) {
+    NodeArena payloadArena;
+    std::shared_ptr<const CommitPayload> payload = makeCommitPayload(payloadArena, L"", L"", L"", CommitStats{ 4, 1, 512 });
+    CommitHistory history;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 1; i <= commitCount; i++)
+        history.insert(i, payload);
+    double insertSeconds = secondsSince(start);
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> pick(1, commitCount);
+    int found = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < commitCount; i++) {
+        if (history.search(pick(rng), commitCount))
+            found++;
+    }
+    double searchSeconds = secondsSince(start);
+
+    int agreed = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < commitCount; i++) {
+        int version = pick(rng);
+        int commit = pick(rng);
+        if ((history.search(commit, version) != nullptr) == (commit <= version))
+            agreed++;
+    }
+    double historySeconds = secondsSince(start);
+
+    long long visited = 0;
+    start = std::chrono::steady_clock::now();
+    for (CommitCursor c = history.cursor(commitCount); c.valid(); c.next())
+        visited += c.node().payload->stats.linesAdded;
+    double iterateSeconds = secondsSince(start);
+
+    char label[32];
+    snprintf(label, sizeof(label), "shipped, %d mods", CommitNode::MAX_MODS);
+    const double ns = 1e9 / commitCount;
+    printf("%-20s %9d commits | insert %7.1f ns/op | search %7.1f ns/op | as-of search %7.1f ns/op | iterate %6.1f ns/op | nodes %7.1f B/commit%s\n",
+        label, commitCount, insertSeconds * ns, searchSeconds * ns, historySeconds * ns, iterateSeconds * ns,
+        (double)history.nodeArena().bytesInUse() / commitCount,
+        (found == commitCount && agreed == commitCount && visited == 4LL * commitCount) ? "" : " (lookup mismatch)");
+    history.clear();
+}
+
+
+static void runPolicies(int commitCount) {
+    runPolicy<FatNodePolicy<1> >("fat node, 1 mod", commitCount);
+    runPolicy<FatNodePolicy<3> >("fat node, 3 mods", commitCount);
+    runPolicy<FatNodePolicy<8> >("fat node, 8 mods", commitCount);
+    runPolicy<NodeCopyingPolicy<2> >("node copying, 2", commitCount);
+    runPolicy<NodeCopyingPolicy<4> >("node copying, 4", commitCount);
+    runPolicy<PathCopyingPolicy>("path copying", commitCount);
+    runShippedTree(commitCount);
+}
+
+
+// repository image: write once, then map and search it without loading anything
+static void runImage(int commitCount) {
+    std::vector<CommitInfo> commits;
+    commits.reserve(commitCount);
+    for (int i = 1; i <= commitCount; i++) {
+        commits.push_back({ i, L"commit_" + std::to_wstring(i) + L".txt",
+            L"Added: 4, Removed: 1", L"Commit message for revision " + std::to_wstring(i), CommitStats{ 4, 1, 512 }, i, L"bench" });
+    }
+    CommitHistory history;
+    history.bulkLoad(std::move(commits));
+    // a tail of single commits so the image carries mod logs as well
+    for (int i = 1; i <= commitCount / 10; i++)
+        history.insert(commitCount + i, L"tail", L"Added: 1, Removed: 0");
+    int total = history.size(history.latestVersion());
+    const std::wstring path = L"minivc_bench.img";
+
+    auto start = std::chrono::steady_clock::now();
+    bool written = writeCommitImage(history, path);
+    double writeSeconds = secondsSince(start);
+
+    CommitImage image;
+    start = std::chrono::steady_clock::now();
+    bool opened = written && image.open(path);
+    double openSeconds = secondsSince(start);
+    if (!opened) {
+        printf("%-8s %9d commits | could not write or map the image\n", "image", commitCount);
+        return;
+    }
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> pick(1, total);
+    int found = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < total; i++) {
+        if (image.search(pick(rng), image.latestVersion()) != IMAGE_NIL)
+            found++;
+    }
+    double searchSeconds = secondsSince(start);
+
+    // what a plugin start does with the image: copy the newest version out and bulk load it
+    start = std::chrono::steady_clock::now();
+    std::vector<CommitInfo> loaded;
+    loaded.reserve(total);
+    image.forEach(image.latestVersion(), [&](CommitImage::NodeIndex node) { loaded.push_back(image.infoOf(node)); });
+    CommitHistory reloaded;
+    reloaded.bulkLoad(std::move(loaded));
+    double reloadSeconds = secondsSince(start);
+
+    printf("%-8s %9d commits | write %7.3f s | map %7.3f ms | search %7.1f ns/op | reload %7.3f s | file %7.1f B/commit%s\n",
+        "image", total, writeSeconds, openSeconds * 1e3, searchSeconds * 1e9 / total, reloadSeconds,
+        (double)image.fileBytes() / total,
+        (found == total && reloaded.size(reloaded.latestVersion()) == total) ? "" : " (lookup mismatch)");
+
+    image.close();
+    remove("minivc_bench.img");
+    reloaded.clear();
+    history.clear();
+}
+
+
+// stored object codec on text shaped like a source file, lines repeat with different numbers in them
+static void runCodec(int lineCount) {
+    std::mt19937 rng(42);
+    const char* shapes[] = { "    int %s%u = %s(%u, count);\n", "    if (%s%u > 0) {\n        %s(%u);\n    }\n",
+        "// %s the %u-th entry, see %s %u\n", "    %s.push_back(%u); %s += %u;\n" };
+    const char* words[] = { "value", "compute", "index", "offset", "total", "buffer", "entry", "result" };
+    std::string text;
+    char line[256];
+    for (int i = 0; i < lineCount; i++) {
+        snprintf(line, sizeof(line), shapes[rng() % 4], words[rng() % 8], (unsigned)(rng() % 1000), words[rng() % 8],
+            (unsigned)(rng() % 100000));
+        text += line;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::string packed = packObject(text);
+    double packSeconds = secondsSince(start);
+
+    // into one buffer, the way a viewer reusing its text buffer decodes
+    const int rounds = 10;
+    std::string unpacked(text.size(), '\0');
+    bool intact = true;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+        intact = lzDecompress(packed.data() + LZ_HEADER, packed.size() - LZ_HEADER, &unpacked[0], unpacked.size()) && intact;
+    double unpackSeconds = secondsSince(start) / rounds;
+
+    printf("%-8s %9d lines | %8.1f KB -> %8.1f KB | ratio %5.2f | compress %7.0f MB/s | decompress %7.0f MB/s%s\n",
+        "codec", lineCount, text.size() / 1024.0, packed.size() / 1024.0, (double)text.size() / packed.size(),
+        text.size() / packSeconds / 1e6, text.size() / unpackSeconds / 1e6, intact && unpacked == text ? "" : " (mismatch)");
+
+    // The viewer's worst read: the newest text of a full delta chain, a whole text and then
+    // PACK_DELTA_DEPTH - 1 forward deltas of a few changed lines each, against that text stored whole
+    const int chain = 15;
+    std::vector<std::string> stored;
+    stored.push_back(packed);
+    std::string newest = text;
+    for (int i = 0; i < chain; i++) {
+        std::string next = newest;
+        for (int edit = 0; edit < 3; edit++) {
+            size_t at = next.find('\n', rng() % next.size());
+            if (at == std::string::npos)
+                continue;
+            snprintf(line, sizeof(line), shapes[rng() % 4], words[rng() % 8], (unsigned)(rng() % 1000), words[rng() % 8],
+                (unsigned)(rng() % 100000));
+            next.insert(at + 1, line);
+        }
+        stored.push_back(packObject(encodeDelta(newest, next)));
+        newest.swap(next);
+    }
+    size_t deltaBytes = 0;
+    for (size_t i = 1; i < stored.size(); i++)
+        deltaBytes += stored[i].size();
+    std::string newestPacked = packObject(newest);
+
+    std::string read;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+        intact = unpackObject(newestPacked, read) && intact;
+    double wholeSeconds = secondsSince(start) / rounds;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        intact = unpackObject(stored[0], read) && intact;
+        for (size_t d = 1; d < stored.size(); d++) {
+            std::string delta, next;
+            intact = unpackObject(stored[d], delta) && applyDelta(read, delta, next) && intact;
+            read.swap(next);
+        }
+    }
+    double chainSeconds = secondsSince(start) / rounds;
+    printf("%-8s %9d deltas | %8.1f KB for the deltas | newest whole %7.3f ms | through the chain %7.3f ms%s\n",
+        "chain", chain, deltaBytes / 1024.0, wholeSeconds * 1e3, chainSeconds * 1e3, intact && read == newest ? "" : " (mismatch)");
+}
+
+
+// file layer: small writes gathered or not, and whole-file reads the old way, sized, and mapped.
+// The file is in the page cache by the time it is read, so the reads measure the copies
+static void runFileIO(int kilobytes) {
+    const std::wstring path = L"minivc_bench.io";
+    std::string record(100, 'x');
+    size_t records = (size_t)kilobytes * 1024 / record.size();
+    double bytes = (double)records * record.size();
+
+    auto start = std::chrono::steady_clock::now();
+    FILE* fp = openFile(path, L"wb");
+    for (size_t i = 0; i < records && fp; i++)
+        fwrite(record.data(), 1, record.size(), fp);
+    bool ok = fp && fclose(fp) == 0;
+    double stdioSeconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    fp = openFile(path, L"wb");
+    if (fp) {
+        FileWriter out(fp);
+        for (size_t i = 0; i < records; i++)
+            out.write(record.data(), record.size());
+        ok = out.finish() && ok;
+        ok = fclose(fp) == 0 && ok;
+    }
+    double writerSeconds = secondsSince(start);
+
+    // what ReadFileAsString did: 1 KB at a time into a stream, then a copy out of it
+    start = std::chrono::steady_clock::now();
+    std::string streamed;
+    fp = openFile(path, L"rb");
+    if (fp) {
+        std::ostringstream oss;
+        char buffer[1024];
+        size_t got;
+        while ((got = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+            oss.write(buffer, got);
+        fclose(fp);
+        streamed = oss.str();
+    }
+    double streamSeconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    std::string sized;
+    ok = readFile(path, sized) && ok;
+    double sizedSeconds = secondsSince(start);
+
+    // mapped: open, then touch a byte of every page so each one is really brought in
+    start = std::chrono::steady_clock::now();
+    MappedFile mapped;
+    unsigned touched = 0;
+    if (mapped.open(path)) {
+        for (size_t at = 0; at < mapped.size(); at += 4096)
+            touched += (unsigned char)mapped.data()[at];
+    }
+    double mapSeconds = secondsSince(start);
+    bool same = ok && streamed.size() == (size_t)bytes && sized == streamed && mapped.size() == sized.size()
+        && memcmp(mapped.data(), sized.data(), sized.size()) == 0 && touched > 0;
+    mapped.close();
+    remove("minivc_bench.io");
+
+    printf("%-8s %9d KB | write stdio %7.0f MB/s | writer %7.0f MB/s | read stream %7.0f MB/s | readFile %7.0f MB/s | map %7.0f MB/s%s\n",
+        "io", kilobytes, bytes / stdioSeconds / 1e6, bytes / writerSeconds / 1e6, bytes / streamSeconds / 1e6,
+        bytes / sizedSeconds / 1e6, bytes / mapSeconds / 1e6, same ? "" : " (mismatch)");
+}
+
+
+// Latency distribution of one kind of operation, one sample per call. Samples include the
+// ~20 ns it takes to read the clock.
+struct LatencySamples {
+    std::vector<uint32_t> ns;
+
+    template <class Op>
+    void time(Op op) {
+        auto start = std::chrono::steady_clock::now();
+        op();
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        ns.push_back(elapsed > 0xFFFFFFFFLL ? 0xFFFFFFFFu : (uint32_t)elapsed);
+    }
+
+    void print(const char* label) {
+        if (ns.empty())
+            return;
+        std::sort(ns.begin(), ns.end());
+        auto at = [&](double p) { return ns[(size_t)(p * (ns.size() - 1))]; };
+        printf("  %-10s p50 %7u ns | p90 %7u ns | p99 %7u ns | p99.9 %8u ns | max %9u ns | %9zu samples\n",
+            label, at(0.5), at(0.9), at(0.99), at(0.999), ns.back(), ns.size());
+    }
+};
+
+
+// Synthetic histories the way the plugin builds them:
+//   sequential  commits 1..n in order, one version each
+//   random      the same commits inserted in random order
+//   rollback    sequential, but every 100 commits or so the newest 0-50 are rolled back and recommitted
+static void runLatency(const char* workload, int commitCount) {
+    CommitHistory history;
+    std::mt19937 rng(42);
+    LatencySamples inserts, rollbacks, searches, successors, steps;
+    size_t rssBefore = residentBytes();
+
+    std::vector<int> order;
+    if (strcmp(workload, "random") == 0) {
+        order.resize(commitCount);
+        for (int i = 0; i < commitCount; i++)
+            order[i] = i + 1;
+        std::shuffle(order.begin(), order.end(), rng);
+    }
+    inserts.ns.reserve(commitCount);
+    int next = 1;
+    for (int i = 0; i < commitCount; i++) {
+        int commit = order.empty() ? next++ : order[i];
+        std::wstring file = L"commit_" + std::to_wstring(commit) + L".txt";
+        inserts.time([&] { history.insert(commit, file, L"Added: 4, Removed: 1", L"message", CommitStats{ 4, 1, 512 }); });
+        if (strcmp(workload, "rollback") == 0 && rng() % 100 == 0) {
+            int back = next - 1 - (int)(rng() % 51);
+            rollbacks.time([&] { history.truncateAfter(back); });
+            next = back + 1;
+        }
+    }
+    size_t rssAfter = residentBytes();
+    int latest = history.latestVersion();
+    int size = history.size(latest);
+    int highest = size > 0 ? history.select(size - 1, latest)->commitCounter : 1;
+
+    // as-of searches at random versions, then successors and a full walk at the newest
+    std::uniform_int_distribution<int> pickCommit(1, highest);
+    std::uniform_int_distribution<int> pickVersion(1, latest);
+    int queries = commitCount < 1000000 ? commitCount : 1000000;
+    int found = 0;
+    searches.ns.reserve(queries);
+    for (int i = 0; i < queries; i++) {
+        int commit = pickCommit(rng);
+        int version = pickVersion(rng);
+        searches.time([&] { found += history.search(commit, version) != nullptr; });
+    }
+    successors.ns.reserve(queries);
+    for (int i = 0; i < queries; i++) {
+        int commit = pickCommit(rng);
+        successors.time([&] { found += history.successor(commit, latest) != nullptr; });
+    }
+    // one sample per 64 cursor steps, a single step is below the clock's resolution
+    int walked = 0;
+    CommitCursor cursor = history.cursor(latest);
+    while (cursor.valid()) {
+        int stepped = 0;
+        steps.time([&] {
+            for (; stepped < 64 && cursor.valid(); stepped++)
+                cursor.next();
+        });
+        steps.ns.back() /= (uint32_t)stepped;
+        walked += stepped;
+    }
+
+    printf("%-10s %9d commits | %d live, %d versions | nodes %7.1f B/commit | RSS +%8.1f MB%s\n",
+        workload, commitCount, size, latest, (double)history.nodeArena().bytesInUse() / commitCount,
+        (double)(rssAfter - rssBefore) / (1024.0 * 1024.0), walked == size ? "" : " (walk mismatch)");
+    inserts.print("insert");
+    rollbacks.print("rollback");
+    searches.print("as-of");
+    successors.print("successor");
+    steps.print("iterate");
+
+    history.clear();
+}
+
+
+static void runLatencies(int commitCount) {
+    runLatency("sequential", commitCount);
+    runLatency("random", commitCount);
+    runLatency("rollback", commitCount);
+}
+
+
+// AVL from CommitTree.h and B+-tree from CommitBTree.h behind the same calls, for runVersus
+struct AvlIndex {
+    CommitHistory history;
+
+    static const char* name() { return "avl"; }
+    void insert(int commit, const std::shared_ptr<const CommitPayload>& payload) { history.insert(commit, payload); }
+    const CommitPayload* search(int commit, int version) const {
+        auto node = history.search(commit, version);
+        return node ? node->payload.get() : nullptr;
+    }
+    int successor(int commit, int version) const {
+        auto node = history.successor(commit, version);
+        return node ? node->commitCounter : -1;
+    }
+    CommitCursor cursor(int version) const { return history.cursor(version); }
+    size_t nodeBytes() const { return history.nodeArena().bytesInUse(); }
+};
+
+struct BTreeIndex {
+    CommitBTree tree;
+
+    static const char* name() { return "b+tree"; }
+    void insert(int commit, const std::shared_ptr<const CommitPayload>& payload) { tree.insert(commit, payload); }
+    const CommitPayload* search(int commit, int version) const { return tree.search(commit, version); }
+    int successor(int commit, int version) const {
+        CommitBTreeCursor c = tree.successor(commit, version);
+        return c.valid() ? c.commit() : -1;
+    }
+    CommitBTreeCursor cursor(int version) const { return tree.cursor(version); }
+    size_t nodeBytes() const { return tree.nodeBytes(); }
+};
+
+
+// One index over the given payloads: insert time, as-of search and successor latency, iteration
+// and node bytes per commit. Queries come from a fixed seed, so both indexes answer the same
+// ones and the checksum has to match
+template <class Index>
+static long long runIndex(const char* workload, const std::vector<int>& order,
+    const std::vector<std::shared_ptr<const CommitPayload> >& payloads) {
+    std::unique_ptr<Index> index(new Index);
+    LatencySamples searches, successors, steps;
+    int commitCount = (int)order.size();
+    size_t rssBefore = residentBytes();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < commitCount; i++)
+        index->insert(order[i], payloads[i]);
+    double insertSeconds = secondsSince(start);
+    size_t rssAfter = residentBytes();
+    size_t nodeBytes = index->nodeBytes();
+
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> pick(1, commitCount);
+    int queries = commitCount < 1000000 ? commitCount : 1000000;
+    long long checksum = 0;
+    searches.ns.reserve(queries);
+    for (int i = 0; i < queries; i++) {
+        int commit = pick(rng);
+        int version = pick(rng);
+        searches.time([&] {
+            const CommitPayload* found = index->search(commit, version);
+            checksum += found ? found->stats.linesAdded : 0;
+        });
+    }
+    successors.ns.reserve(queries);
+    for (int i = 0; i < queries; i++) {
+        int commit = pick(rng);
+        int version = pick(rng);
+        successors.time([&] { checksum += index->successor(commit, version); });
+    }
+    // one sample per 64 cursor steps, a single step is below the clock's resolution
+    int walked = 0;
+    auto cursor = index->cursor(commitCount);
+    while (cursor.valid()) {
+        int stepped = 0;
+        steps.time([&] {
+            for (; stepped < 64 && cursor.valid(); stepped++)
+                cursor.next();
+        });
+        steps.ns.back() /= (uint32_t)stepped;
+        walked += stepped;
+    }
+
+    printf("%-6s %-10s %9d commits | insert %7.1f ns/op | nodes %7.1f B/commit | RSS +%8.1f MB%s\n",
+        Index::name(), workload, commitCount, insertSeconds * 1e9 / commitCount, (double)nodeBytes / commitCount,
+        (double)(rssAfter - rssBefore) / (1024.0 * 1024.0), walked == commitCount ? "" : " (walk mismatch)");
+    searches.print("as-of");
+    successors.print("successor");
+    steps.print("iterate");
+    return checksum;
+}
+
+
+// AVL against B+-tree on the same commits, in order and shuffled. Payloads are built once
+// up front in an arena of their own and shared, so the byte counts are the indexes alone
+static void runVersus(int commitCount) {
+    NodeArena payloadArena;
+    std::vector<std::shared_ptr<const CommitPayload> > payloads;
+    payloads.reserve(commitCount);
+    for (int i = 1; i <= commitCount; i++)
+        payloads.push_back(makeCommitPayload(payloadArena, L"commit.txt", L"", L"", CommitStats{ i, 1, 512 }));
+
+    std::vector<int> order(commitCount);
+    for (int shuffled = 0; shuffled < 2; shuffled++) {
+        const char* workload = shuffled ? "random" : "sequential";
+        for (int i = 0; i < commitCount; i++)
+            order[i] = i + 1;
+        if (shuffled) {
+            std::mt19937 rng(42);
+            std::shuffle(order.begin(), order.end(), rng);
+        }
+        // the payload of commit c has c lines added, whatever position it is inserted at
+        std::vector<std::shared_ptr<const CommitPayload> > inOrder(commitCount);
+        for (int i = 0; i < commitCount; i++)
+            inOrder[i] = payloads[order[i] - 1];
+
+        long long avl = runIndex<AvlIndex>(workload, order, inOrder);
+        long long btree = runIndex<BTreeIndex>(workload, order, inOrder);
+        if (avl != btree)
+            printf("  answers differ between the indexes\n");
+    }
+}
+
+
+// Reference model for the differential check: the full commit map of every version
+struct ModelCommit {
+    CommitStats stats;
+    long long timestamp;
+};
+typedef std::map<int, ModelCommit> ModelVersion;
+
+
+// Runs random edits against CommitHistory and a std::map per version side by side and
+// compares every query on the new version and on a few random older ones.
+// Returns false and says where on the first difference.
+static bool checkSeed(unsigned seed, int operations) {
+    std::mt19937 rng(seed);
+    const int keys = 2000;
+    CommitHistory history;
+    std::vector<ModelVersion> model(1);
+    const char* op = "";
+    int step = 0;
+
+    auto fail = [&](const char* what, int version, long long key) {
+        printf("check seed %u: %s differs after %s (operation %d), version %d, key %lld\n",
+            seed, what, op, step, version, key);
+        return false;
+    };
+
+    auto compare = [&](int version) {
+        const ModelVersion& m = model[version];
+        if (history.size(version) != (int)m.size())
+            return fail("size", version, 0);
+        std::vector<int> walked;
+        for (CommitCursor c = history.cursor(version); c.valid(); c.next())
+            walked.push_back(c.commit());
+        size_t position = 0;
+        for (const auto& entry : m) {
+            if (position >= walked.size() || walked[position++] != entry.first)
+                return fail("iteration", version, entry.first);
+        }
+        for (int q = 0; q < 20; q++) {
+            int key = (int)(rng() % (keys + 2)) - 1;
+            auto node = history.search(key, version);
+            auto found = m.find(key);
+            if ((node != nullptr) != (found != m.end()))
+                return fail("search", version, key);
+            if (node && (!(node->payload->stats == found->second.stats) || node->payload->timestamp != found->second.timestamp))
+                return fail("payload", version, key);
+            auto after = m.upper_bound(key);
+            node = history.successor(key, version);
+            if ((node ? node->commitCounter : -1) != (after == m.end() ? -1 : after->first))
+                return fail("successor", version, key);
+            auto atOrAfter = m.lower_bound(key);
+            node = history.predecessor(key, version);
+            if ((node ? node->commitCounter : -1) != (atOrAfter == m.begin() ? -1 : std::prev(atOrAfter)->first))
+                return fail("predecessor", version, key);
+            int rank = (int)std::distance(m.begin(), atOrAfter);
+            if (history.rank(key, version) != rank)
+                return fail("rank", version, key);
+            if (!m.empty()) {
+                int k = (int)(rng() % m.size());
+                node = history.select(k, version);
+                if (!node || node->commitCounter != walked[k])
+                    return fail("select", version, k);
+            }
+            int to = key + (int)(rng() % 200);
+            CommitStats churn = CommitStats();
+            int count = 0;
+            for (auto it = atOrAfter; it != m.end() && it->first <= to; ++it) {
+                churn = churn + it->second.stats;
+                count++;
+            }
+            if (history.countInRange(key, to, version) != count)
+                return fail("countInRange", version, key);
+            if (!(history.churnInRange(key, to, version) == churn))
+                return fail("churnInRange", version, key);
+            long long time = (long long)(rng() % 40000);
+            int newest = -1;
+            for (const auto& entry : m) {
+                if (entry.second.timestamp <= time)
+                    newest = entry.first;
+            }
+            node = history.asOfTime(time, version);
+            if ((node ? node->commitCounter : -1) != newest)
+                return fail("asOfTime", version, time);
+        }
+        return true;
+    };
+
+    long long clock = 0;
+    for (step = 0; step < operations; step++) {
+        ModelVersion next = model.back();
+        int pick = (int)(rng() % 100);
+        if (pick < 70) {
+            op = "insert";
+            int key = (int)(rng() % keys);
+            if (next.count(key))
+                continue;
+            CommitStats stats{ (long long)(rng() % 50), (long long)(rng() % 50), (long long)(rng() % 5000) };
+            // clock mostly moves forward, sometimes back
+            clock += (long long)(rng() % 40) - 8;
+            long long timestamp = clock;
+            auto after = next.upper_bound(key);
+            if (after != next.begin() && timestamp < std::prev(after)->second.timestamp)
+                timestamp = std::prev(after)->second.timestamp;
+            if (after != next.end() && timestamp > after->second.timestamp)
+                timestamp = after->second.timestamp;
+            history.insert(key, L"f", L"d", L"m", stats, clock);
+            next[key] = ModelCommit{ stats, timestamp };
+        }
+        else if (pick < 80) {
+            op = "truncateAfter";
+            int key = (int)(rng() % keys);
+            history.truncateAfter(key);
+            next.erase(next.upper_bound(key), next.end());
+        }
+        else if (pick < 88) {
+            op = "removeRange";
+            int from = (int)(rng() % keys);
+            int to = from + (int)(rng() % 100);
+            history.removeRange(from, to);
+            next.erase(next.lower_bound(from), next.upper_bound(to));
+        }
+        else if (pick < 94) {
+            op = "keepRange";
+            int from = (int)(rng() % keys);
+            int to = from + (int)(rng() % 1500);
+            history.keepRange(from, to);
+            next.erase(next.begin(), next.lower_bound(from));
+            next.erase(next.upper_bound(to), next.end());
+        }
+        else if (pick < 97) {
+            op = "bulkLoad";
+            std::vector<CommitInfo> commits;
+            next.clear();
+            long long time = 0;
+            for (int key = 0; key < keys; key++) {
+                if (rng() % 3)
+                    continue;
+                time += (long long)(rng() % 30);
+                CommitStats stats{ 1, 2, 3 };
+                commits.push_back({ key, L"f", L"d", L"m", stats, time, L"" });
+                next[key] = ModelCommit{ stats, time };
+            }
+            std::shuffle(commits.begin(), commits.end(), rng);
+            history.bulkLoad(commits);
+            clock = time;
+        }
+        else {
+            // compaction makes no new version, the dropped ones read as empty
+            op = "compact";
+            std::vector<int> keep;
+            for (int v = 0; v < (int)model.size(); v++) {
+                if (rng() % 8 == 0)
+                    keep.push_back(v);
+            }
+            // the report counts this history's nodes, whatever else lives in the process
+            size_t nodesBefore = history.memoryReport().nodes;
+            CompactionReport report = history.compact(keep);
+            size_t nodesAfter = history.memoryReport().nodes;
+            if (report.nodesFreed != (nodesBefore > nodesAfter ? nodesBefore - nodesAfter : 0))
+                return fail("compaction report", (int)report.nodesFreed, (int)(nodesBefore - nodesAfter));
+            std::vector<bool> kept(model.size(), false);
+            for (int v : keep)
+                kept[v] = true;
+            kept.back() = true;
+            for (size_t v = 0; v < model.size(); v++) {
+                if (!kept[v])
+                    model[v].clear();
+            }
+            for (int q = 0; q < 5; q++) {
+                if (!compare((int)(rng() % model.size())))
+                    return false;
+            }
+            continue;
+        }
+
+        model.push_back(std::move(next));
+        if (history.latestVersion() != (int)model.size() - 1)
+            return fail("version count", history.latestVersion(), 0);
+        if (!compare(history.latestVersion()))
+            return false;
+        if (!compare((int)(rng() % model.size())))
+            return false;
+    }
+    return true;
+}
+
+
+// Inserts in random commit order and rolls back an IndexedCommitTree, then reads random
+// versions against a std::set per version.
+static bool checkIndexed(unsigned seed) {
+    std::mt19937 rng(seed);
+    const int keys = 500;
+    IndexedCommitTree tree;
+    std::vector<std::set<int>> model(1);
+    for (int step = 0; step < 800; step++) {
+        std::set<int> next = model.back();
+        int key = (int)(rng() % keys);
+        int version;
+        if (rng() % 10 == 0) {
+            version = tree.truncateAfter(key);
+            next.erase(next.upper_bound(key), next.end());
+        }
+        else {
+            if (next.count(key))
+                continue;
+            version = tree.insertNode(key, L"f", L"d");
+            next.insert(key);
+        }
+        model.push_back(std::move(next));
+        if (version != (int)model.size() - 1 || tree.latestVersion() != version) {
+            printf("check seed %u: indexed tree made version %d, expected %d\n", seed, version, (int)model.size() - 1);
+            return false;
+        }
+        for (int q = 0; q < 20; q++) {
+            int v = (int)(rng() % model.size());
+            int probe = (int)(rng() % (keys + 2)) - 1;
+            const std::set<int>& m = model[v];
+            auto after = m.upper_bound(probe);
+            auto atOrAfter = m.lower_bound(probe);
+            IndexedCommitTree::NodeIndex successor = tree.getSuccessor(probe, v);
+            IndexedCommitTree::NodeIndex predecessor = tree.getPredecessor(probe, v);
+            if ((tree.searchCommit(probe, v) != IndexedCommitTree::NIL) != (m.count(probe) > 0)
+                || (successor == IndexedCommitTree::NIL ? -1 : tree.commitOf(successor)) != (after == m.end() ? -1 : *after)
+                || (predecessor == IndexedCommitTree::NIL ? -1 : tree.commitOf(predecessor))
+                    != (atOrAfter == m.begin() ? -1 : *std::prev(atOrAfter))) {
+                printf("check seed %u: indexed tree differs at version %d, key %d\n", seed, v, probe);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+// Inserts into a CommitBTree in random order, some commits twice, then reads random versions
+// against a std::map per version.
+static bool checkBTree(unsigned seed) {
+    std::mt19937 rng(seed);
+    const int keys = 3000;
+    NodeArena payloadArena;
+    CommitBTree tree;
+    std::vector<std::shared_ptr<const CommitPayload>> payloads;
+    std::vector<std::map<int, const CommitPayload*>> model(1);
+    for (int step = 0; step < 2000; step++) {
+        int key = (int)(rng() % keys);
+        payloads.push_back(makeCommitPayload(payloadArena, L"f", L"d", L"m"));
+        tree.insert(key, payloads.back());
+        model.push_back(model.back());
+        model.back()[key] = payloads.back().get();
+        if (step % 10 != 0)
+            continue;
+        int v = (int)(rng() % model.size());
+        const std::map<int, const CommitPayload*>& m = model[v];
+        auto entry = m.begin();
+        CommitBTreeCursor c = tree.cursor(v);
+        for (; c.valid() && entry != m.end(); c.next(), ++entry) {
+            if (c.commit() != entry->first || &c.payload() != entry->second)
+                break;
+        }
+        bool ok = !c.valid() && entry == m.end() && tree.size(v) == (int)m.size();
+        for (int q = 0; ok && q < 50; q++) {
+            int probe = (int)(rng() % (keys + 2)) - 1;
+            auto found = m.find(probe);
+            auto after = m.upper_bound(probe);
+            auto atOrAfter = m.lower_bound(probe);
+            CommitBTreeCursor successor = tree.successor(probe, v);
+            CommitBTreeCursor predecessor = tree.predecessor(probe, v);
+            ok = tree.search(probe, v) == (found == m.end() ? nullptr : found->second)
+                && (successor.valid() ? successor.commit() : -1) == (after == m.end() ? -1 : after->first)
+                && (predecessor.valid() ? predecessor.commit() : -1) == (atOrAfter == m.begin() ? -1 : std::prev(atOrAfter)->first);
+        }
+        if (!ok) {
+            printf("check seed %u: B+-tree differs at version %d after %d inserts\n", seed, v, step + 1);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// Filters the timeline rows into the middle of a history and reads them in list order,
+// backwards and at random against the commits in range.
+static bool checkRows(unsigned seed) {
+    std::mt19937 rng(seed);
+    CommitRepository repository;
+    std::vector<std::pair<int, long long>> commits;
+    long long clock = 0;
+    for (int i = 0; i < 300; i++) {
+        int key = i * 3 + (int)(rng() % 3);
+        clock += (long long)(rng() % 5);
+        repository.insert(key, L"f", L"d", L"m", CommitStats(), clock);
+        commits.push_back(std::make_pair(key, clock));
+    }
+    for (int round = 0; round < 20; round++) {
+        long long from = (long long)(rng() % (clock + 2));
+        long long to = round % 4 == 0 ? LLONG_MAX : from + (long long)(rng() % 400);
+        std::vector<int> expected;
+        for (const auto& c : commits) {
+            if (c.second >= from && c.second <= to)
+                expected.push_back(c.first);
+        }
+        CommitRows rows(repository.snapshot());
+        rows.at(5);
+        rows.filter(from, to);
+        bool ok = rows.size() == (int)expected.size();
+        for (int i = 0; ok && i < (int)expected.size(); i++) {
+            const CommitNode* node = rows.at(i);
+            ok = node && node->commitCounter == expected[i];
+        }
+        for (int i = (int)expected.size() - 1; ok && i >= 0; i--) {
+            const CommitNode* node = rows.at(i);
+            ok = node && node->commitCounter == expected[i];
+        }
+        for (int q = 0; ok && q < 20 && !expected.empty(); q++) {
+            int i = (int)(rng() % expected.size());
+            const CommitNode* node = rows.at(i);
+            ok = node && node->commitCounter == expected[i];
+        }
+        ok = ok && rows.at((int)expected.size()) == nullptr && rows.at(-1) == nullptr;
+        if (!ok) {
+            printf("check seed %u: timeline rows differ for times %lld to %lld\n", seed, from, to);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// One writer inserts, rolls back, compacts and resets a CommitRepository while readers query
+// whatever snapshot is published. Every snapshot must read as one consistent version, and
+// built with -fsanitize=thread this shows whether anything is freed under a reader.
+static bool checkReaders(unsigned seed) {
+    CommitRepository repository;
+    std::atomic<bool> done(false);
+    std::atomic<int> failures(0);
+
+    auto reader = [&](unsigned readerSeed) {
+        std::mt19937 rng(readerSeed);
+        while (!done.load()) {
+            std::shared_ptr<const CommitSnapshot> snap = repository.snapshot();
+            int size = snap->size();
+            std::vector<int> walked;
+            for (CommitCursor c = snap->cursor(); c.valid(); c.next()) {
+                if (c.node().payload->diffData != std::to_wstring(c.commit()))
+                    failures++;
+                walked.push_back(c.commit());
+            }
+            if ((int)walked.size() != size || !std::is_sorted(walked.begin(), walked.end()))
+                failures++;
+            for (int q = 0; q < 10 && !walked.empty(); q++) {
+                int k = (int)(rng() % walked.size());
+                const CommitNode* node = snap->select(k);
+                if (!node || node->commitCounter != walked[k] || snap->search(walked[k]) != node)
+                    failures++;
+            }
+            CommitRows rows(snap);
+            rows.filter(size / 2, LLONG_MAX);
+            for (int i = 0; i < rows.size(); i++) {
+                const CommitNode* node = rows.at(i);
+                if (!node || node->payload->timestamp < size / 2)
+                    failures++;
+            }
+        }
+    };
+
+    std::thread readers[3] = { std::thread(reader, seed * 3 + 1), std::thread(reader, seed * 3 + 2),
+        std::thread(reader, seed * 3 + 3) };
+    std::mt19937 rng(seed);
+    int next = 1;
+    for (int step = 0; step < 3000; step++) {
+        int pick = (int)(rng() % 100);
+        if (pick < 85) {
+            repository.insert(next, L"f", std::to_wstring(next), L"m", CommitStats(), next);
+            next++;
+        }
+        else if (pick < 93) {
+            repository.truncateAfter(next - 1 - (int)(rng() % 20));
+        }
+        else if (pick < 99) {
+            int latest = repository.history().latestVersion();
+            repository.compact(std::vector<int>(1, latest / 2));
+        }
+        else {
+            repository.reset();
+            next = 1;
+        }
+        repository.reclaim();
+    }
+    done = true;
+    for (auto& t : readers)
+        t.join();
+    if (failures.load() > 0) {
+        printf("check seed %u: readers saw %d inconsistent snapshots\n", seed, failures.load());
+        return false;
+    }
+    return true;
+}
+
+
+// Forks branches off random versions of the main line and off revisions of other branches,
+// commits on them and reads every revision against a std::set per revision. The main line
+// has to read as it did before any branch existed.
+static bool checkBranches(unsigned seed) {
+    std::mt19937 rng(seed);
+    const int keys = 400;
+    CommitHistory history;
+    std::vector<std::set<int>> mainline(1);
+    for (int step = 0; step < 300; step++) {
+        std::set<int> next = mainline.back();
+        int key = (int)(rng() % keys);
+        if (rng() % 8 == 0) {
+            history.truncateAfter(key);
+            next.erase(next.upper_bound(key), next.end());
+        }
+        else {
+            if (next.count(key))
+                continue;
+            history.insert(key, L"f", L"d", L"m", CommitStats(), step);
+            next.insert(key);
+        }
+        mainline.push_back(std::move(next));
+    }
+
+    auto fail = [&](const std::wstring& name, int revision, int key) {
+        printf("check seed %u: branch %ls differs at revision %d, key %d\n", seed, name.c_str(), revision, key);
+        return false;
+    };
+
+    std::map<std::wstring, std::vector<std::set<int>>> model;
+    for (int b = 0; b < 6; b++) {
+        std::wstring name = L"b" + std::to_wstring(b);
+        if (b < 2 || rng() % 2) {
+            int version = (int)(rng() % mainline.size());
+            if (!history.createBranch(name, version))
+                return fail(name, 0, -1);
+            model[name].push_back(mainline[version]);
+        }
+        else {
+            auto parent = model.begin();
+            std::advance(parent, rng() % model.size());
+            int revision = (int)(rng() % parent->second.size());
+            if (!history.createBranch(name, parent->first, revision))
+                return fail(name, 0, -1);
+            model[name].push_back(parent->second[revision]);
+        }
+        if (history.createBranch(name, 0))
+            return fail(name, 0, -2);
+    }
+    for (int step = 0; step < 400; step++) {
+        auto entry = model.begin();
+        std::advance(entry, rng() % model.size());
+        std::set<int> next = entry->second.back();
+        int key = (int)(rng() % keys);
+        if (next.count(key))
+            continue;
+        int revision = history.branch(entry->first)->insert(key, makeCommitPayload(history.nodeArena(), L"f", L"d", L"m"));
+        next.insert(key);
+        entry->second.push_back(std::move(next));
+        if (revision != (int)entry->second.size() - 1)
+            return fail(entry->first, revision, key);
+    }
+
+    for (const auto& entry : model) {
+        const CommitBranch* branch = history.branch(entry.first);
+        for (int revision = 0; revision < (int)entry.second.size(); revision++) {
+            const std::set<int>& m = entry.second[revision];
+            if (branch->size(revision) != (int)m.size())
+                return fail(entry.first, revision, -1);
+            auto expected = m.begin();
+            CommitCursor c = branch->cursor(revision);
+            for (; c.valid() && expected != m.end(); c.next(), ++expected) {
+                if (c.commit() != *expected)
+                    return fail(entry.first, revision, *expected);
+            }
+            if (c.valid() || expected != m.end())
+                return fail(entry.first, revision, -1);
+            for (int q = 0; q < 10; q++) {
+                int probe = (int)(rng() % (keys + 2)) - 1;
+                auto after = m.upper_bound(probe);
+                auto atOrAfter = m.lower_bound(probe);
+                auto successor = branch->successor(probe, revision);
+                auto predecessor = branch->predecessor(probe, revision);
+                if ((branch->search(probe, revision) != nullptr) != (m.count(probe) > 0)
+                    || (successor ? successor->commitCounter : -1) != (after == m.end() ? -1 : *after)
+                    || (predecessor ? predecessor->commitCounter : -1) != (atOrAfter == m.begin() ? -1 : *std::prev(atOrAfter)))
+                    return fail(entry.first, revision, probe);
+            }
+        }
+    }
+    for (int version = 0; version < (int)mainline.size(); version++) {
+        std::vector<int> walked;
+        for (CommitCursor c = history.cursor(version); c.valid(); c.next())
+            walked.push_back(c.commit());
+        if (history.latestVersion() != (int)mainline.size() - 1
+            || walked != std::vector<int>(mainline[version].begin(), mainline[version].end())) {
+            printf("check seed %u: main line version %d changed by a branch\n", seed, version);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// true if the payload holds what info does
+static bool samePayload(const CommitPayload& payload, const CommitInfo& info) {
+    return payload.fileName == info.fileName && payload.diffData == info.diffData
+        && payload.commitMessage == info.commitMessage && payload.stats == info.stats
+        && payload.timestamp == info.timestamp && payload.author == info.author;
+}
+
+static bool writeWholeFile(const std::wstring& path, const std::string& contents) {
+    FILE* fp = openFile(path, L"wb");
+    if (!fp)
+        return false;
+    bool written = contents.empty() || fwrite(contents.data(), 1, contents.size(), fp) == contents.size();
+    return fclose(fp) == 0 && written;
+}
+
+static const wchar_t* const CHECK_PACK = L"minivc_check.pack";
+static const wchar_t* const CHECK_INDEX = L"minivc_check.idx";
+static const wchar_t* const CHECK_IMAGE = L"minivc_check.img";
+
+static void removeCheckFiles() {
+    remove("minivc_check.pack");
+    remove("minivc_check.idx");
+    remove("minivc_check.img");
+}
+
+
+// Writes an image of a random history with rollbacks and reads every version out of the
+// mapped image against the history. An image cut short, with bytes after its end or with a
+// damaged header must not open.
+static bool checkImage(unsigned seed) {
+    std::mt19937 rng(seed);
+    CommitHistory history;
+    long long clock = 0;
+    for (int step = 0; step < 400; step++) {
+        int key = (int)(rng() % 600);
+        if (rng() % 10 == 0) {
+            history.truncateAfter(key);
+        }
+        else if (!history.search(key, history.latestVersion())) {
+            clock += (long long)(rng() % 10);
+            CommitStats stats{ (long long)(rng() % 50), (long long)(rng() % 50), (long long)(rng() % 5000) };
+            history.insert(key, L"f" + std::to_wstring(key), std::wstring(rng() % 20, L'd'),
+                L"m\u00e9\U0001F600", stats, clock, rng() % 2 ? L"" : L"author");
+        }
+    }
+
+    auto fail = [&](const char* what, int version, int key) {
+        printf("check seed %u: image %s differs at version %d, key %d\n", seed, what, version, key);
+        removeCheckFiles();
+        return false;
+    };
+
+    CommitImage image;
+    if (!writeCommitImage(history, CHECK_IMAGE) || !image.open(CHECK_IMAGE))
+        return fail("open", 0, 0);
+    if (image.latestVersion() != history.latestVersion())
+        return fail("version count", image.latestVersion(), 0);
+    auto commitOf = [&](CommitImage::NodeIndex node) { return node == IMAGE_NIL ? -1 : image.commitOf(node); };
+    for (int version = 0; version <= history.latestVersion(); version++) {
+        std::vector<const CommitNode*> walked;
+        for (CommitCursor c = history.cursor(version); c.valid(); c.next())
+            walked.push_back(&c.node());
+        if (image.size(version) != (int)walked.size())
+            return fail("size", version, 0);
+        size_t position = 0;
+        bool same = true;
+        image.forEach(version, [&](CommitImage::NodeIndex node) {
+            same = same && position < walked.size() && image.commitOf(node) == walked[position]->commitCounter
+                && samePayload(*walked[position]->payload, image.infoOf(node));
+            position++;
+        });
+        if (!same || position != walked.size())
+            return fail("iteration", version, 0);
+        for (int q = 0; q < 10; q++) {
+            int probe = (int)(rng() % 602) - 1;
+            auto found = history.search(probe, version);
+            auto after = history.successor(probe, version);
+            auto before = history.predecessor(probe, version);
+            if (commitOf(image.search(probe, version)) != (found ? found->commitCounter : -1)
+                || commitOf(image.successor(probe, version)) != (after ? after->commitCounter : -1)
+                || commitOf(image.predecessor(probe, version)) != (before ? before->commitCounter : -1))
+                return fail("search", version, probe);
+            long long time = (long long)(rng() % (clock + 2)) - 1;
+            auto asOf = history.asOfTime(time, version);
+            if (commitOf(image.asOfTime(time, version)) != (asOf ? asOf->commitCounter : -1))
+                return fail("asOfTime", version, (int)time);
+            if (!walked.empty()) {
+                int k = (int)(rng() % walked.size());
+                if (commitOf(image.select(k, version)) != walked[k]->commitCounter)
+                    return fail("select", version, k);
+            }
+        }
+    }
+    image.close();
+
+    std::string contents;
+    if (!readFile(CHECK_IMAGE, contents))
+        return fail("read", 0, 0);
+    for (int round = 0; round < 4; round++) {
+        std::string damaged = contents;
+        if (round == 0)
+            damaged.resize(rng() % contents.size());
+        else if (round == 1)
+            damaged.resize(contents.size() - 1 - rng() % 8);
+        else if (round == 2)
+            damaged.append(1 + rng() % 64, '\0');
+        else
+            damaged[rng() % 8] ^= 0x20;
+        if (!writeWholeFile(CHECK_IMAGE, damaged))
+            return fail("write", 0, round);
+        if (image.open(CHECK_IMAGE))
+            return fail("damaged image opened", 0, round);
+    }
+
+    // records pointing outside their sections: a child, a mod range, a root, a string length
+    ImageHeader layout;
+    memcpy(&layout, contents.data(), sizeof(layout));
+    if (layout.nodeCount == 0 || layout.payloadCount == 0)
+        return fail("empty image", 0, 0);
+    for (int round = 0; round < 4; round++) {
+        std::string damaged = contents;
+        uint64_t node = layout.nodesOffset + rng() % layout.nodeCount * sizeof(ImageNode);
+        uint64_t payload = layout.payloadsOffset + rng() % layout.payloadCount * sizeof(ImagePayload);
+        uint32_t value;
+        if (round == 0) {
+            value = layout.nodeCount + (uint32_t)(rng() % 1000);
+            memcpy(&damaged[node + offsetof(ImageNode, left)], &value, sizeof(value));
+        }
+        else if (round == 1) {
+            value = layout.childModCount;
+            memcpy(&damaged[node + offsetof(ImageNode, firstChildMod)], &value, sizeof(value));
+            uint16_t mods = 1;
+            memcpy(&damaged[node + offsetof(ImageNode, leftMods)], &mods, sizeof(mods));
+        }
+        else if (round == 2) {
+            value = layout.nodeCount;
+            memcpy(&damaged[layout.rootsOffset + rng() % layout.versionCount * sizeof(uint32_t)], &value, sizeof(value));
+        }
+        else {
+            value = 0x7fffffff;
+            memcpy(&damaged[payload + offsetof(ImagePayload, fileNameLength)], &value, sizeof(value));
+        }
+        if (!writeWholeFile(CHECK_IMAGE, damaged))
+            return fail("write", 1, round);
+        if (image.open(CHECK_IMAGE))
+            return fail("damaged record opened", 1, round);
+    }
+
+    // a node that is its own left child passes every bound, walks have to stop on their own
+    uint32_t root;
+    memcpy(&root, &contents[layout.rootsOffset + (layout.versionCount - 1) * sizeof(uint32_t)], sizeof(root));
+    if (root != IMAGE_NIL) {
+        std::string damaged = contents;
+        uint64_t node = layout.nodesOffset + root * sizeof(ImageNode);
+        uint16_t none = 0;
+        memcpy(&damaged[node + offsetof(ImageNode, left)], &root, sizeof(root));
+        memcpy(&damaged[node + offsetof(ImageNode, leftMods)], &none, sizeof(none));
+        if (!writeWholeFile(CHECK_IMAGE, damaged) || !image.open(CHECK_IMAGE))
+            return fail("cycle", 0, 0);
+        if (image.forEach(image.latestVersion(), [](CommitImage::NodeIndex) {}))
+            return fail("cycle walked", 0, 0);
+        image.search(INT_MIN, image.latestVersion());
+        image.close();
+    }
+    removeCheckFiles();
+    return true;
+}
+
+
+// Rebuilds a history through HistoryLoad.h the way the plugin loads one: the image and the
+// records after what the index covered, or every record in the pack without a sound image
+static void loadFromPack(ObjectPack& pack, CommitRepository& repository) {
+    size_t replayed = 0;
+    if (!loadCommitImage(repository, pack, CHECK_IMAGE, replayed))
+        loadPackRecords(repository, pack, std::map<int, CommitInfo>());
+}
+
+
+// Commits texts into an ObjectPack round after round and reopens it in between: with a
+// current index, with one older than the pack, with an image written after the index, and
+// after a crash left a torn or damaged record at the end. Blobs, live commits and records
+// must read back as they were added, replay must rebuild the history, and the file must be
+// cut back to where the last whole record ends.
+static bool checkPack(unsigned seed) {
+    std::mt19937 rng(seed);
+    removeCheckFiles();
+
+    auto fail = [&](const char* what, int round, int key) {
+        printf("check seed %u: pack %s differs in round %d, key %d\n", seed, what, round, key);
+        removeCheckFiles();
+        return false;
+    };
+
+    struct StoredBlob {
+        std::string body;
+        uint32_t depth;
+    };
+    std::map<std::string, StoredBlob> blobs;    // by the 32 bytes of the hash
+    std::map<int, std::string> live;            // commit number to its blob's hash
+    std::vector<DeltaRecord> written;
+    CommitHistory history;
+    ObjectPack pack;
+    bool created = false;
+    if (!pack.open(CHECK_PACK, CHECK_INDEX, created) || !created)
+        return fail("create", 0, 0);
+
+    std::string text;
+    uint64_t indexed = 0;
+    int next = 1;
+    long long clock = 0;
+    for (int round = 0; round < 8; round++) {
+        for (int step = 0; step < 40; step++) {
+            if (rng() % 8 == 0 && next > 1) {
+                int key = (int)(rng() % next);
+                CommitInfo truncate = { key, L"", L"", L"", CommitStats(), 0, L"" };
+                pack.addRecord(DELTA_TRUNCATE, truncate, ContentHash());
+                history.truncateAfter(key);
+                live.erase(live.upper_bound(key), live.end());
+                written.push_back(DeltaRecord{ DELTA_TRUNCATE, truncate });
+                next = key + 1;
+            }
+            else {
+                size_t at = text.empty() ? 0 : rng() % text.size();
+                text.insert(at, "line " + std::to_string(rng() % 100) + "\n");
+                ContentHash hash = hashContent(text);
+                std::string key((const char*)hash.bytes, 32);
+                if (!blobs.count(key)) {
+                    StoredBlob blob = { packObject(text), (uint32_t)(rng() % 3) };
+                    pack.addBlob(hash, blob.depth, blob.body);
+                    blobs[key] = blob;
+                }
+                clock += (long long)(rng() % 10);
+                CommitInfo commit = { next, L"f", L"d" + std::to_wstring(next), L"m\u00e9", CommitStats{ 1, 2, (long long)text.size() },
+                    clock, rng() % 2 ? L"" : L"author" };
+                pack.addRecord(DELTA_COMMIT, commit, hash);
+                history.insert(commit.commitNumber, commit.fileName, commit.diffData, commit.commitMessage,
+                    commit.stats, commit.timestamp, commit.author);
+                live[next++] = key;
+                written.push_back(DeltaRecord{ DELTA_COMMIT, commit });
+            }
+            if (rng() % 4 == 0 && !pack.flush())
+                return fail("flush", round, next);
+        }
+        if (!pack.flush())
+            return fail("flush", round, next);
+
+        // fold: image and index, the image alone as if the plugin died in between, or neither
+        int fold = (int)(rng() % 3);
+        if (fold < 2 && !writeCommitImage(history, CHECK_IMAGE))
+            return fail("image write", round, 0);
+        if (fold == 0) {
+            if (!pack.writeIndex(CHECK_INDEX))
+                return fail("index write", round, 0);
+            indexed = pack.bytes();
+        }
+        uint64_t bytes = pack.bytes();
+        pack.close();
+
+        // a crash in the middle of an append: a header with part of its body, or a whole
+        // record whose body no longer matches its checksum
+        int crash = (int)(rng() % 3);
+        if (crash > 0) {
+            PackRecordHeader head = PackRecordHeader();
+            head.type = DELTA_COMMIT;
+            std::string body(64 + rng() % 64, 'x');
+            head.bodyBytes = (uint32_t)body.size();
+            head.check = packChecksum(body.data(), body.size()) + 1;
+            std::string tail((const char*)&head, sizeof(head));
+            tail += body;
+            if (crash == 1)
+                tail.resize(1 + rng() % (tail.size() - 1));
+            std::string contents;
+            if (!readFile(CHECK_PACK, contents) || !writeWholeFile(CHECK_PACK, contents + tail))
+                return fail("crash write", round, 0);
+        }
+
+        if (!pack.open(CHECK_PACK, CHECK_INDEX, created) || created)
+            return fail("reopen", round, 0);
+        std::string reopened;
+        if (pack.bytes() != bytes || pack.indexedBytes() != indexed || !readFile(CHECK_PACK, reopened)
+            || reopened.size() != bytes)
+            return fail("length", round, crash);
+
+        std::vector<DeltaRecord> records = pack.records(0);
+        if (records.size() != written.size())
+            return fail("record count", round, (int)records.size());
+        for (size_t i = 0; i < records.size(); i++) {
+            const CommitInfo& a = records[i].commit;
+            const CommitInfo& b = written[i].commit;
+            if (records[i].type != written[i].type || a.commitNumber != b.commitNumber
+                || (records[i].type == DELTA_COMMIT && !samePayload(CommitPayload(a.fileName, a.diffData,
+                    a.commitMessage, a.stats, a.timestamp, a.author), b)))
+                return fail("record", round, b.commitNumber);
+        }
+
+        FileSpan span;
+        std::string buffer, raw;
+        for (int key = 0; key <= next; key++) {
+            const PackEntry* entry = pack.commit(key);
+            auto found = live.find(key);
+            if ((entry != nullptr) != (found != live.end()))
+                return fail("commit index", round, key);
+            if (entry && (!pack.read(*entry, span, buffer) || span.size < 32 || memcmp(span.data, found->second.data(), 32) != 0))
+                return fail("commit blob hash", round, key);
+        }
+        for (const auto& blob : blobs) {
+            ContentHash hash;
+            memcpy(hash.bytes, blob.first.data(), 32);
+            const PackEntry* entry = pack.blob(hash);
+            if (!entry || entry->depth != blob.second.depth || !pack.read(*entry, span, buffer)
+                || std::string(span.data, span.size) != blob.second.body
+                || !unpackObject(span.data, span.size, raw) || memcmp(hashContent(raw).bytes, hash.bytes, 32) != 0)
+                return fail("blob", round, 0);
+        }
+
+        CommitRepository repository;
+        loadFromPack(pack, repository);
+        const CommitHistory& loaded = repository.history();
+        std::vector<const CommitNode*> expected, got;
+        for (CommitCursor c = history.cursor(history.latestVersion()); c.valid(); c.next())
+            expected.push_back(&c.node());
+        for (CommitCursor c = loaded.cursor(loaded.latestVersion()); c.valid(); c.next())
+            got.push_back(&c.node());
+        if (expected.size() != got.size())
+            return fail("replay size", round, (int)got.size());
+        for (size_t i = 0; i < expected.size(); i++) {
+            const CommitPayload& p = *expected[i]->payload;
+            if (got[i]->commitCounter != expected[i]->commitCounter
+                || !samePayload(*got[i]->payload, CommitInfo{ 0, p.fileName, p.diffData, p.commitMessage, p.stats, p.timestamp, p.author }))
+                return fail("replay", round, expected[i]->commitCounter);
+        }
+    }
+    pack.close();
+    removeCheckFiles();
+    return true;
+}
+
+
+// Random text for the codec check: source-like lines, random bytes, nothing, or bytes that
+// start like a stored object or a delta
+static std::string codecText(std::mt19937& rng) {
+    std::string text;
+    int kind = (int)(rng() % 5);
+    size_t size = rng() % 3 == 0 ? rng() % 64 : rng() % 20000;
+    if (kind == 0) {
+        while (text.size() < size)
+            text += "    value = compute(" + std::to_string(rng() % 50) + ");\n";
+    }
+    else if (kind == 1) {
+        for (size_t i = 0; i < size; i++)
+            text.push_back((char)rng());
+    }
+    else if (kind == 3 || kind == 4) {
+        const char* magic = kind == 4 ? DELTA_MAGIC : rng() % 2 ? LZ_MAGIC : LZ_STORED_MAGIC;
+        text.assign(magic, 4);
+        for (size_t i = 0; i < size; i++)
+            text.push_back(rng() % 2 ? 'a' : (char)rng());
+    }
+    return text;
+}
+
+
+// BlockCodec.h and DeltaCodec.h on random texts: every stored object unpacks to its text and
+// every delta rebuilds its target. Cut short, a delta fails and an object fails or still
+// unpacks to its exact text. BLAKE2b-256 of "abc" has to
+// match the published test vector.
+static bool checkCodecs(unsigned seed) {
+    std::mt19937 rng(seed);
+    if (hashContent(std::string("abc")).hex() != L"bddd813c634239723171ef3fee98579b94964e3bb1cb3e427262c8c068d52319") {
+        printf("check seed %u: content hash of \"abc\" is wrong\n", seed);
+        return false;
+    }
+    auto fail = [&](const char* what, int round, size_t size) {
+        printf("check seed %u: %s fails in round %d, %zu bytes\n", seed, what, round, size);
+        return false;
+    };
+    for (int round = 0; round < 60; round++) {
+        std::string raw = codecText(rng), back;
+        std::string stored = packObject(raw);
+        if (!unpackObject(stored, back) || back != raw)
+            return fail("stored object round trip", round, raw.size());
+        bool headed = stored.size() >= LZ_HEADER
+            && (memcmp(stored.data(), LZ_MAGIC, 4) == 0 || memcmp(stored.data(), LZ_STORED_MAGIC, 4) == 0);
+        if (headed && stored.size() > LZ_HEADER) {
+            size_t cut = LZ_HEADER + rng() % (stored.size() - LZ_HEADER);
+            // only the empty sequence that ends a block can go without losing anything
+            if (unpackObject(stored.data(), cut, back) && back != raw)
+                return fail("stored object cut short", round, cut);
+        }
+
+        // the next text: lines moved, cut, added and changed in a few places
+        std::string target = raw;
+        for (int edit = (int)(rng() % 6); edit >= 0; edit--) {
+            size_t at = target.empty() ? 0 : rng() % target.size();
+            size_t length = target.empty() ? 0 : rng() % std::min<size_t>(200, target.size() - at + 1);
+            int pick = (int)(rng() % 3);
+            if (pick == 0)
+                target.erase(at, length);
+            else if (pick == 1)
+                target.insert(at, codecText(rng).substr(0, 300));
+            else
+                target.insert(rng() % (target.size() + 1), target.substr(at, length));
+        }
+        if (rng() % 10 == 0)
+            target.clear();
+        std::string delta = encodeDelta(raw, target);
+        if (!applyDelta(raw, delta, back) || back != target)
+            return fail("delta round trip", round, target.size());
+        size_t cut = rng() % delta.size();
+        if (applyDelta(raw, delta.substr(0, cut), back))
+            return fail("delta cut short", round, cut);
+        if (!raw.empty())
+            applyDelta(raw.substr(0, raw.size() / 2), delta, back);
+    }
+    return true;
+}
+
+
+static int runCheck(int seeds) {
+    int failed = 0;
+    for (int seed = 0; seed < seeds; seed++) {
+        bool ok = checkSeed((unsigned)seed, 1500) && checkIndexed((unsigned)seed) && checkBTree((unsigned)seed)
+            && checkBranches((unsigned)seed) && checkRows((unsigned)seed) && checkImage((unsigned)seed)
+            && checkPack((unsigned)seed) && checkCodecs((unsigned)seed) && (seed % 5 != 0 || checkReaders((unsigned)seed));
+        if (!ok)
+            failed++;
+    }
+    printf("check %d seeds, %d failed\n", seeds, failed);
+    return failed == 0 ? 0 : 1;
+}
+
+
+static void runWorkload(const char* engine, int commitCount) {
+    if (strcmp(engine, "latency") == 0) {
+        runLatencies(commitCount);
+    }
+    else if (strcmp(engine, "image") == 0) {
+        runImage(commitCount);
+    }
+    else if (strcmp(engine, "btree") == 0) {
+        runVersus(commitCount);
+    }
+    else if (strcmp(engine, "codec") == 0) {
+        runCodec(commitCount);
+    }
+    else if (strcmp(engine, "io") == 0) {
+        runFileIO(commitCount);
+    }
+    else if (strcmp(engine, "policies") == 0) {
+        runPolicies(commitCount);
+    }
+    else if (strcmp(engine, "indexed") == 0) {
+        runWorkload<IndexedEngine>(commitCount);
+    }
+    else {
+        runWorkload<PointerEngine>(commitCount);
+        runBulkLoad(commitCount);
+    }
+}
+
+
+int main(int argc, char** argv) {
+#ifdef MINIVC_HEAP_NODES
+    printf("CommitTree benchmark, nodes on the general heap (make_shared)\n");
+#else
+    printf("CommitTree benchmark, nodes in each history's arena\n");
+#endif
+    const char* engine = "pointer";
+    int first = 1;
+    if (argc > 1 && (strcmp(argv[1], "pointer") == 0 || strcmp(argv[1], "indexed") == 0
+        || strcmp(argv[1], "policies") == 0 || strcmp(argv[1], "image") == 0 || strcmp(argv[1], "latency") == 0
+        || strcmp(argv[1], "btree") == 0 || strcmp(argv[1], "codec") == 0 || strcmp(argv[1], "io") == 0)) {
+        engine = argv[1];
+        first = 2;
+    }
+    if (argc > 1 && strcmp(argv[1], "check") == 0)
+        return runCheck(argc > 2 ? atoi(argv[2]) : 50);
+    if (argc > first) {
+        for (int i = first; i < argc; i++)
+            runWorkload(engine, atoi(argv[i]));
+    }
+    else {
+        runWorkload(engine, 10000);
+        runWorkload(engine, 100000);
+        runWorkload(engine, 1000000);
+    }
+    return 0;
+}
@@ -0,0 +1,261 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+// LZ77 block compression for the texts and deltas the plugin stores in its pack; summaries and
+// messages are small and go in as they are. Byte-oriented like LZ4, so decoding is little more
+// than memcpy and runs at memory speed; source text shrinks about 2.5x (`bench codec`).
+//
+// Block: sequences to the end of the input, each
+//   token          high 4 bits literal length, low 4 bits match length - LZ_MIN_MATCH
+//   [length bytes] when a field of the token is 15, bytes of 255 and one below it are added to it
+//   literals
+//   offset         2 bytes little-endian, back from the current output position
+//   [length bytes] for the match length
+// The last sequence has literals only and ends the block.
+//
+// Object: "MVZ1" and the raw size as 8 bytes little-endian, then a block. Objects compression
+// would not make smaller, short messages mostly, are kept raw with no header. Raw bytes that
+// start like a header get "MVZ0" and the raw size in front.
+
+const size_t LZ_MIN_MATCH = 4;
+const size_t LZ_MAX_OFFSET = 65535;
+const int LZ_HASH_BITS = 14;
+const char LZ_MAGIC[4] = { 'M', 'V', 'Z', '1' };
+const char LZ_STORED_MAGIC[4] = { 'M', 'V', 'Z', '0' };
+const size_t LZ_HEADER = 12;
+
+
+uint32_t lzRead32(const char* p) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+uint64_t lzRead64(const char* p) {
+    uint64_t value;
+    memcpy(&value, p, 8);
+    return value;
+}
+
+uint32_t lzHash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// a length field past its 4 token bits
+void lzPutLength(std::string& out, size_t length) {
+    for (; length >= 255; length -= 255)
+        out.push_back((char)255);
+    out.push_back((char)length);
+}
+
+bool lzGetLength(const unsigned char*& in, const unsigned char* end, size_t& length) {
+    for (;;) {
+        if (in == end)
+            return false;
+        unsigned char byte = *in++;
+        length += byte;
+        if (byte != 255)
+            return true;
+    }
+}
+
+
+// Greedy single-probe matcher: one hash slot per 4-byte sequence, each match extended both
+// ways. Positions that keep missing are skipped over faster, so incompressible data passes
+// through at a few hundred MB/s
+void lzCompress(const char* data, size_t size, std::string& out) {
+    out.reserve(out.size() + size + size / 255 + 16);
+    std::vector<uint32_t> table((size_t)1 << LZ_HASH_BITS, 0);
+
+    auto sequence = [&out, data](size_t from, size_t to, size_t offset, size_t length) {
+        size_t literals = to - from;
+        size_t extra = length - LZ_MIN_MATCH;
+        unsigned char token = (unsigned char)((literals < 15 ? literals : 15) << 4);
+        if (length > 0)
+            token |= (unsigned char)(extra < 15 ? extra : 15);
+        out.push_back((char)token);
+        if (literals >= 15)
+            lzPutLength(out, literals - 15);
+        out.append(data + from, literals);
+        if (length == 0)
+            return;
+        out.push_back((char)(offset & 0xFF));
+        out.push_back((char)(offset >> 8));
+        if (extra >= 15)
+            lzPutLength(out, extra - 15);
+    };
+
+    size_t anchor = 0;
+    size_t ip = 0;
+    size_t misses = 0;
+    while (size >= LZ_MIN_MATCH && ip <= size - LZ_MIN_MATCH) {
+        uint32_t& slot = table[lzHash(lzRead32(data + ip))];
+        size_t ref = slot;
+        slot = (uint32_t)ip;
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || lzRead32(data + ref) != lzRead32(data + ip)) {
+            ip += 1 + (misses++ >> 6);
+            continue;
+        }
+        misses = 0;
+
+        while (ip > anchor && ref > 0 && data[ip - 1] == data[ref - 1]) {
+            ip--;
+            ref--;
+        }
+        size_t length = LZ_MIN_MATCH;
+        while (ip + length + 8 <= size && lzRead64(data + ip + length) == lzRead64(data + ref + length))
+            length += 8;
+        while (ip + length < size && data[ip + length] == data[ref + length])
+            length++;
+
+        sequence(anchor, ip, ip - ref, length);
+        ip += length;
+        anchor = ip;
+        // the spot just before the next search, runs of matches pick each other up
+        if (ip >= 2 && ip - 2 + LZ_MIN_MATCH <= size)
+            table[lzHash(lzRead32(data + ip - 2))] = (uint32_t)(ip - 2);
+    }
+    sequence(anchor, size, 0, 0);
+}
+
+
+// Decodes a block into exactly size bytes at out, false if it is damaged or does not fill it.
+// Copies run 8 or 16 bytes at a time and overshoot their end while there is room past it in
+// both buffers; the last few sequences, without that room, go byte by byte
+bool lzDecompress(const char* block, size_t blockSize, char* out, size_t size) {
+    const unsigned char* in = (const unsigned char*)block;
+    const unsigned char* end = in + blockSize;
+    char* op = out;
+    char* outEnd = out + size;
+    while (in < end) {
+        unsigned char token = *in++;
+        size_t literals = token >> 4;
+        if (literals < 15 && end - in >= 18 && outEnd - op >= 34) {
+            // the common case in text, a few literals, then a short match at least 8 back:
+            // fixed-size copies and no loops
+            memcpy(op, in, 16);
+            in += literals;
+            op += literals;
+            size_t offset = in[0] | ((size_t)in[1] << 8);
+            size_t length = token & 15;
+            if (length < 15 && offset >= 8 && offset <= (size_t)(op - out)) {
+                const char* match = op - offset;
+                memcpy(op, match, 8);
+                memcpy(op + 8, match + 8, 8);
+                memcpy(op + 16, match + 16, 2);
+                in += 2;
+                op += length + LZ_MIN_MATCH;
+                continue;
+            }
+        }
+        else {
+            if (literals == 15 && !lzGetLength(in, end, literals))
+                return false;
+            if (literals > (size_t)(end - in) || literals > (size_t)(outEnd - op))
+                return false;
+            if (literals + 16 <= (size_t)(end - in) && literals + 16 <= (size_t)(outEnd - op)) {
+                for (size_t i = 0; i < literals; i += 16)
+                    memcpy(op + i, in + i, 16);
+            }
+            else {
+                memcpy(op, in, literals);
+            }
+            in += literals;
+            op += literals;
+            if (in == end)
+                break;
+        }
+
+        if (end - in < 2)
+            return false;
+        size_t offset = in[0] | ((size_t)in[1] << 8);
+        in += 2;
+        size_t length = token & 15;
+        if (length == 15 && !lzGetLength(in, end, length))
+            return false;
+        length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - out) || length > (size_t)(outEnd - op))
+            return false;
+
+        const char* match = op - offset;
+        if (offset >= 16 && length + 16 <= (size_t)(outEnd - op)) {
+            for (size_t i = 0; i < length; i += 16)
+                memcpy(op + i, match + i, 16);
+        }
+        else if (length + 16 <= (size_t)(outEnd - op)) {
+            // runs of spaces and the like: once a whole number of repeats at least 8 long is
+            // out, the rest copies from that far back 8 bytes at a time
+            size_t distance = offset;
+            while (distance < 8)
+                distance += offset;
+            for (size_t i = 0; i < distance; i++)
+                op[i] = match[i];
+            for (size_t i = distance; i < length; i += 8)
+                memcpy(op + i, op + i - distance, 8);
+        }
+        else {
+            for (size_t i = 0; i < length; i++)
+                op[i] = match[i];
+        }
+        op += length;
+    }
+    return op == outEnd;
+}
+
+
+// The object stored for raw, compressed when that makes it smaller
+std::string packObject(const std::string& raw) {
+    std::string out(LZ_HEADER, '\0');
+    uint64_t size = raw.size();
+    for (int i = 0; i < 8; i++)
+        out[4 + i] = (char)(size >> (8 * i));
+    lzCompress(raw.data(), raw.size(), out);
+    if (out.size() < raw.size()) {
+        memcpy(&out[0], LZ_MAGIC, 4);
+        return out;
+    }
+    bool headerLike = raw.size() >= LZ_HEADER
+        && (memcmp(raw.data(), LZ_MAGIC, 4) == 0 || memcmp(raw.data(), LZ_STORED_MAGIC, 4) == 0);
+    if (!headerLike)
+        return raw;
+    out.resize(LZ_HEADER);
+    memcpy(&out[0], LZ_STORED_MAGIC, 4);
+    out += raw;
+    return out;
+}
+
+
+// Raw bytes of a stored object, false if its header promises what its body does not hold.
+// Decodes straight from wherever the object is, a mapped file included
+bool unpackObject(const char* stored, size_t storedSize, std::string& raw) {
+    bool compressed = storedSize >= LZ_HEADER && memcmp(stored, LZ_MAGIC, 4) == 0;
+    bool kept = storedSize >= LZ_HEADER && memcmp(stored, LZ_STORED_MAGIC, 4) == 0;
+    if (!compressed && !kept) {
+        raw.assign(stored, storedSize);
+        return true;
+    }
+    uint64_t size = 0;
+    for (int i = 7; i >= 0; i--)
+        size = (size << 8) | (unsigned char)stored[4 + i];
+    size_t body = storedSize - LZ_HEADER;
+    if (kept) {
+        if (size != body)
+            return false;
+        raw.assign(stored + LZ_HEADER, body);
+        return true;
+    }
+
+    // a block grows its output at most 255 + 4 times per byte, a damaged size must not turn into a huge allocation
+    if (size > (uint64_t)body * 259)
+        return false;
+    raw.resize((size_t)size);
+    return lzDecompress(stored + LZ_HEADER, body, &raw[0], raw.size());
+}
+
+bool unpackObject(const std::string& stored, std::string& raw) {
+    return unpackObject(stored.data(), stored.size(), raw);
+}
@@ -0,0 +1,449 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "CommitTree.h"
+
+
+// Persistent B+-tree over the same commits and payloads as CommitHistory, for histories in the
+// millions. A lookup touches one node per level and a level has up to 16 children, so a search
+// in a million commits reads 5 nodes instead of ~20 AVL nodes and their mod logs.
+//
+// Nodes are never changed once built. An insert copies the nodes on its path from the root
+// (copy-on-write path copying) and the new root is the new version, so every older version
+// stays readable as it was. Leaves are not linked to each other, a sibling link would have to
+// be copied along with every leaf it points to; cursors keep the path instead.
+//
+// A node is three cache lines: the count and the keys share the first one, so picking a child
+// scans one line and then reads one child pointer. Nodes come from 64-byte aligned slabs owned
+// by the tree and are only freed with it.
+//
+// Only the benchmark runs it (bench btree). The plugin keeps CommitHistory: rollback, bulk
+// load, compaction, branches, rank and time queries, the image and the snapshots published
+// to readers are all built on it and this tree has none of them.
+struct CommitBTreeNode {
+    static const int KEYS = 15;
+    static const int CHILDREN = KEYS + 1;
+
+    uint16_t count;         // keys in a leaf, children in an inner node
+    uint16_t leaf;
+    int keys[KEYS];         // inner nodes: keys[i] is the smallest commit under children[i + 1]
+    union {
+        const CommitBTreeNode* children[CHILDREN];
+        const CommitPayload* payloads[CHILDREN];
+    };
+};
+
+
+// In-order cursor over one version of a CommitBTree, the same moves as CommitCursor.
+// Holds raw node pointers, it must not outlive the tree it came from
+class CommitBTreeCursor {
+public:
+    CommitBTreeCursor() : root(nullptr), depth(0) {}
+    explicit CommitBTreeCursor(const CommitBTreeNode* top) : root(top), depth(0) { first(); }
+
+    bool valid() const { return depth > 0; }
+    int commit() const { return nodes[depth - 1]->keys[slots[depth - 1]]; }
+    const CommitPayload& payload() const { return *nodes[depth - 1]->payloads[slots[depth - 1]]; }
+
+    void first() {
+        depth = 0;
+        if (root)
+            descend(root, false);
+    }
+
+    void last() {
+        depth = 0;
+        if (root)
+            descend(root, true);
+    }
+
+    // moves to the first commit at or after target, true if target itself exists
+    bool seek(int target) {
+        depth = 0;
+        for (const CommitBTreeNode* n = root; n; ) {
+            int slot = n->leaf ? countBelow(n, target) : countNotAbove(n, target);
+            push(n, slot);
+            n = n->leaf ? nullptr : n->children[slot];
+        }
+        if (depth == 0)
+            return false;
+        if (slots[depth - 1] == nodes[depth - 1]->count) {
+            slots[depth - 1]--;
+            next();
+            return false;
+        }
+        return commit() == target;
+    }
+
+    // moves to the last commit before target
+    void seekBefore(int target) {
+        depth = 0;
+        for (const CommitBTreeNode* n = root; n; ) {
+            // an inner node's keys[i] below target means children[i + 1] holds a commit below it
+            int slot = countBelow(n, target);
+            push(n, slot);
+            n = n->leaf ? nullptr : n->children[slot];
+        }
+        if (depth == 0)
+            return;
+        if (slots[depth - 1] == 0) {
+            prev();
+            return;
+        }
+        slots[depth - 1]--;
+    }
+
+    void next() {
+        if (++slots[depth - 1] < nodes[depth - 1]->count)
+            return;
+        depth--;
+        while (depth > 0 && slots[depth - 1] + 1 >= nodes[depth - 1]->count)
+            depth--;
+        if (depth == 0)
+            return;
+        slots[depth - 1]++;
+        descend(nodes[depth - 1]->children[slots[depth - 1]], false);
+    }
+
+    void prev() {
+        if (slots[depth - 1] > 0) {
+            slots[depth - 1]--;
+            return;
+        }
+        depth--;
+        while (depth > 0 && slots[depth - 1] == 0)
+            depth--;
+        if (depth == 0)
+            return;
+        slots[depth - 1]--;
+        descend(nodes[depth - 1]->children[slots[depth - 1]], true);
+    }
+
+private:
+    // 16-way nodes at least half full past the root reach 2^31 commits well within this
+    static const int MAX_DEPTH = 16;
+
+    // keys below target
+    static int countBelow(const CommitBTreeNode* n, int target) {
+        int keys = n->leaf ? n->count : n->count - 1;
+        int i = 0;
+        while (i < keys && n->keys[i] < target)
+            i++;
+        return i;
+    }
+
+    // keys not above target, the child of an inner node that would hold it
+    static int countNotAbove(const CommitBTreeNode* n, int target) {
+        int keys = n->leaf ? n->count : n->count - 1;
+        int i = 0;
+        while (i < keys && n->keys[i] <= target)
+            i++;
+        return i;
+    }
+
+    void push(const CommitBTreeNode* n, int slot) {
+        nodes[depth] = n;
+        slots[depth] = slot;
+        depth++;
+    }
+
+    void descend(const CommitBTreeNode* n, bool rightmost) {
+        for (;;) {
+            push(n, rightmost ? n->count - 1 : 0);
+            if (n->leaf)
+                return;
+            n = n->children[slots[depth - 1]];
+        }
+    }
+
+    const CommitBTreeNode* root;
+    const CommitBTreeNode* nodes[MAX_DEPTH];
+    int slots[MAX_DEPTH];
+    int depth;
+};
+
+
+// Roots of every version, like CommitHistory. Version 0 is the empty tree and every insert
+// adds one. Inserting a commit that is already there gives it the new payload
+class CommitBTree {
+public:
+    typedef CommitBTreeNode Node;
+
+    CommitBTree() : roots(1, nullptr), sizes(1, 0), nodesUsed(0), slabFree(0), slabCursor(nullptr) {}
+
+    CommitBTree(const CommitBTree&) = delete;
+    CommitBTree& operator=(const CommitBTree&) = delete;
+
+    int latestVersion() const { return (int)roots.size() - 1; }
+
+    // root as of version, versions past the newest read the newest
+    const Node* rootAt(int version) const {
+        if (version < 0) return roots.front();
+        if (version >= (int)roots.size()) return roots.back();
+        return roots[version];
+    }
+
+    int size(int version) const {
+        if (version < 0) return 0;
+        if (version >= (int)sizes.size()) return sizes.back();
+        return sizes[version];
+    }
+
+    size_t nodeCount() const { return nodesUsed; }
+
+    // Bytes held by the nodes, payloads excluded
+    size_t nodeBytes() const { return nodesUsed * sizeof(Node); }
+
+    int insert(int commitCounter, const std::wstring& fileName, const std::wstring& diffData,
+        const std::wstring& commitMessage = L"", const CommitStats& stats = CommitStats(),
+        long long timestamp = 0, const std::wstring& author = L"") {
+        return insert(commitCounter, makeCommitPayload(payloadArena, fileName, diffData, commitMessage, stats, timestamp, author));
+    }
+
+    // adds a commit as a new version and returns that version. Copies one node per level
+    int insert(int commitCounter, const std::shared_ptr<const CommitPayload>& payload) {
+        owned.push_back(payload);
+        const CommitPayload* data = payload.get();
+        const Node* root = roots.back();
+        int count = sizes.back();
+        if (!root) {
+            Node* leaf = newNode(true);
+            leaf->count = 1;
+            leaf->keys[0] = commitCounter;
+            leaf->payloads[0] = data;
+            return pushRoot(leaf, 1);
+        }
+
+        // walk down once and remember the path
+        path.clear();
+        const Node* node = root;
+        while (!node->leaf) {
+            int slot = 0;
+            while (slot < node->count - 1 && node->keys[slot] <= commitCounter)
+                slot++;
+            path.push_back(PathStep{ node, slot });
+            node = node->children[slot];
+        }
+
+        int pos = 0;
+        while (pos < node->count && node->keys[pos] < commitCounter)
+            pos++;
+
+        // the new leaf, split in two when it overflows
+        Node* left;
+        Node* right = nullptr;
+        int separator = 0;
+        if (pos < node->count && node->keys[pos] == commitCounter) {
+            left = copyNode(node);
+            left->payloads[pos] = data;
+        }
+        else {
+            count++;
+            int keys[Node::KEYS + 1];
+            const CommitPayload* values[Node::KEYS + 1];
+            int n = spliceEntry(node->keys, node->payloads, node->count, pos, commitCounter, data, keys, values);
+            int keep = splitPoint(n, Node::KEYS, pos);
+            left = newNode(true);
+            fillLeaf(left, keys, values, 0, keep);
+            if (keep < n) {
+                right = newNode(true);
+                fillLeaf(right, keys, values, keep, n);
+                separator = keys[keep];
+            }
+        }
+
+        // walk back up copying every node on the path, splits carry a separator up
+        for (size_t depth = path.size(); depth > 0; depth--) {
+            const Node* parent = path[depth - 1].node;
+            int slot = path[depth - 1].slot;
+            if (!right) {
+                Node* copy = copyNode(parent);
+                copy->children[slot] = left;
+                left = copy;
+                continue;
+            }
+            int keys[Node::CHILDREN];
+            const Node* children[Node::CHILDREN + 1];
+            for (int i = 0; i < parent->count; i++)
+                children[i + (i > slot)] = parent->children[i];
+            children[slot] = left;
+            children[slot + 1] = right;
+            for (int i = 0; i < parent->count - 1; i++)
+                keys[i + (i >= slot)] = parent->keys[i];
+            keys[slot] = separator;
+            int n = parent->count + 1;
+            int keep = splitPoint(n, Node::CHILDREN, slot + 1);
+            left = newNode(false);
+            fillInner(left, keys, children, 0, keep);
+            if (keep < n) {
+                right = newNode(false);
+                fillInner(right, keys, children, keep, n);
+                separator = keys[keep - 1];
+            }
+            else {
+                right = nullptr;
+            }
+        }
+        if (right) {
+            Node* top = newNode(false);
+            top->count = 2;
+            top->keys[0] = separator;
+            top->children[0] = left;
+            top->children[1] = right;
+            left = top;
+        }
+        return pushRoot(left, count);
+    }
+
+    // payload of commit as of version, null if it is not in the tree
+    const CommitPayload* search(int commit, int version) const {
+        const Node* node = rootAt(version);
+        if (!node)
+            return nullptr;
+        while (!node->leaf) {
+            int slot = 0;
+            while (slot < node->count - 1 && node->keys[slot] <= commit)
+                slot++;
+            node = node->children[slot];
+        }
+        for (int i = 0; i < node->count; i++) {
+            if (node->keys[i] == commit)
+                return node->payloads[i];
+        }
+        return nullptr;
+    }
+
+    // cursor on the first commit after commit as of version, not valid if there is none
+    CommitBTreeCursor successor(int commit, int version) const {
+        CommitBTreeCursor c(rootAt(version));
+        if (commit == INT_MAX)
+            return CommitBTreeCursor();
+        c.seek(commit + 1);
+        return c;
+    }
+
+    // cursor on the last commit before commit as of version, not valid if there is none
+    CommitBTreeCursor predecessor(int commit, int version) const {
+        CommitBTreeCursor c(rootAt(version));
+        c.seekBefore(commit);
+        return c;
+    }
+
+    CommitBTreeCursor cursor(int version) const {
+        return CommitBTreeCursor(rootAt(version));
+    }
+
+    // calls visit(commit, payload) for every commit as of version, in commit order
+    template <class Visitor>
+    void forEach(int version, Visitor visit) const {
+        for (CommitBTreeCursor c = cursor(version); c.valid(); c.next())
+            visit(c.commit(), c.payload());
+    }
+
+    // drops every version, node and payload
+    void clear() {
+        roots.assign(1, nullptr);
+        sizes.assign(1, 0);
+        owned.clear();
+        payloadArena.release();
+        slabs.clear();
+        nodesUsed = 0;
+        slabFree = 0;
+        slabCursor = nullptr;
+    }
+
+private:
+    struct PathStep {
+        const Node* node;
+        int slot;
+    };
+
+    static const size_t NODES_PER_SLAB = 1024;
+    static const size_t LINE = 64;
+
+    int pushRoot(const Node* root, int count) {
+        roots.push_back(root);
+        sizes.push_back(count);
+        return latestVersion();
+    }
+
+    // nodes are plain data, a slab is handed back whole without running destructors
+    Node* newNode(bool leaf) {
+        if (slabFree == 0) {
+            slabs.emplace_back(new char[NODES_PER_SLAB * sizeof(Node) + LINE]);
+            uintptr_t start = reinterpret_cast<uintptr_t>(slabs.back().get());
+            slabCursor = reinterpret_cast<char*>((start + LINE - 1) & ~(uintptr_t)(LINE - 1));
+            slabFree = NODES_PER_SLAB;
+        }
+        Node* node = reinterpret_cast<Node*>(slabCursor);
+        slabCursor += sizeof(Node);
+        slabFree--;
+        nodesUsed++;
+        node->count = 0;
+        node->leaf = leaf ? 1 : 0;
+        return node;
+    }
+
+    Node* copyNode(const Node* node) {
+        Node* copy = newNode(node->leaf != 0);
+        *copy = *node;
+        return copy;
+    }
+
+    // entries of a full node plus the new one at pos, returns how many
+    static int spliceEntry(const int* keys, const CommitPayload* const* values, int count, int pos,
+        int key, const CommitPayload* value, int* outKeys, const CommitPayload** outValues) {
+        for (int i = 0, j = 0; i <= count; i++) {
+            if (i == pos) {
+                outKeys[i] = key;
+                outValues[i] = value;
+            }
+            else {
+                outKeys[i] = keys[j];
+                outValues[i] = values[j];
+                j++;
+            }
+        }
+        return count + 1;
+    }
+
+    // how many of n entries stay in the left node. Appending past the end keeps the left
+    // node full, so commits arriving in order pack the nodes instead of leaving them half empty
+    static int splitPoint(int n, int capacity, int inserted) {
+        if (n <= capacity)
+            return n;
+        if (inserted == n - 1)
+            return capacity;
+        return n / 2;
+    }
+
+    static void fillLeaf(Node* leaf, const int* keys, const CommitPayload* const* values, int from, int to) {
+        leaf->count = (uint16_t)(to - from);
+        for (int i = from; i < to; i++) {
+            leaf->keys[i - from] = keys[i];
+            leaf->payloads[i - from] = values[i];
+        }
+    }
+
+    // children [from, to) and the keys between them, keys[i] separates children i and i + 1
+    static void fillInner(Node* inner, const int* keys, const Node* const* children, int from, int to) {
+        inner->count = (uint16_t)(to - from);
+        for (int i = from; i < to; i++) {
+            inner->children[i - from] = children[i];
+            if (i + 1 < to)
+                inner->keys[i - from] = keys[i];
+        }
+    }
+
+    NodeArena payloadArena;     // first, so it outlives the payloads in owned
+    std::vector<const Node*> roots;
+    std::vector<int> sizes;
+    std::vector<std::shared_ptr<const CommitPayload>> owned;   // every payload any version reads
+    std::vector<std::unique_ptr<char[]>> slabs;
+    size_t nodesUsed;
+    size_t slabFree;
+    char* slabCursor;
+    std::vector<PathStep> path;      // scratch path reused by insert
+};
@@ -0,0 +1,637 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "CommitTree.h"
+#include "FileIO.h"
+
+
+// On-disk image of a CommitHistory: every node, mod log and version root, laid out so the
+// file can be memory mapped and queried in place. Links are node indices, strings are
+// offsets into one UTF-16 block, so the image works wherever it is mapped.
+// Nodes are written breadth first from the newest root, the top of the tree people actually
+// search shares a few pages. Branches are not part of the image.
+//
+// File: ImageHeader, nodes, child mods, shape mods, version roots, payloads, strings.
+// Every section starts on an 8 byte boundary, all integers are little endian.
+
+const uint32_t IMAGE_NIL = 0xFFFFFFFFu;
+const uint32_t IMAGE_FORMAT = 2;
+
+// No AVL tree of 2^32 nodes is deeper than 47 levels, a walk that goes on longer is going
+// round a cycle in a damaged image
+const int IMAGE_MAX_DEPTH = 64;
+const char IMAGE_MAGIC[8] = { 'M', 'i', 'n', 'i', 'V', 'C', 'i', 'm' };
+
+struct ImageStats {
+    int64_t linesAdded;
+    int64_t linesRemoved;
+    int64_t bytes;
+};
+
+struct ImageHeader {
+    char magic[8];
+    uint32_t format;
+    uint32_t nodeCount;
+    uint32_t childModCount;
+    uint32_t shapeModCount;
+    uint32_t versionCount;
+    uint32_t payloadCount;
+    uint64_t nodesOffset;
+    uint64_t childModsOffset;
+    uint64_t shapeModsOffset;
+    uint64_t rootsOffset;
+    uint64_t payloadsOffset;
+    uint64_t stringsOffset;
+    uint64_t fileBytes;
+};
+
+// base fields as the node was created, its mods follow in the mod sections
+struct ImageNode {
+    int32_t commit;
+    uint32_t payload;
+    uint32_t left;
+    uint32_t right;
+    int32_t height;
+    int32_t size;
+    ImageStats totals;
+    uint32_t firstChildMod;     // left mods, then right mods
+    uint16_t leftMods;
+    uint16_t rightMods;
+    uint32_t firstShapeMod;
+    uint32_t shapeMods;
+};
+
+struct ImageChildMod {
+    int32_t version;
+    uint32_t child;
+};
+
+struct ImageShapeMod {
+    int32_t version;
+    int32_t height;
+    int32_t size;
+    int32_t unused;
+    ImageStats totals;
+};
+
+// string offsets and lengths count UTF-16 units in the string block
+struct ImagePayload {
+    uint64_t fileName;
+    uint64_t diffData;
+    uint64_t commitMessage;
+    uint64_t author;
+    uint32_t fileNameLength;
+    uint32_t diffDataLength;
+    uint32_t commitMessageLength;
+    uint32_t authorLength;
+    ImageStats stats;
+    int64_t timestamp;
+};
+
+static_assert(sizeof(ImageHeader) == 88, "image header layout");
+static_assert(sizeof(ImageNode) == 64, "image node layout");
+static_assert(sizeof(ImageChildMod) == 8, "image child mod layout");
+static_assert(sizeof(ImageShapeMod) == 40, "image shape mod layout");
+static_assert(sizeof(ImagePayload) == 80, "image payload layout");
+
+
+// appends s to units as UTF-16, wchar_t is 16 bits on Windows and 32 elsewhere
+void appendUtf16(std::vector<uint16_t>& units, const std::wstring& s) {
+    for (wchar_t ch : s) {
+        uint32_t c = (uint32_t)ch;
+        if (c >= 0x10000 && c <= 0x10FFFF) {
+            c -= 0x10000;
+            units.push_back((uint16_t)(0xD800 + (c >> 10)));
+            units.push_back((uint16_t)(0xDC00 + (c & 0x3FF)));
+        }
+        else {
+            units.push_back((uint16_t)c);
+        }
+    }
+}
+
+
+std::wstring fromUtf16(const uint16_t* units, size_t length) {
+    std::wstring s;
+    s.reserve(length);
+    for (size_t i = 0; i < length; i++) {
+        uint32_t c = units[i];
+        if (sizeof(wchar_t) == 4 && c >= 0xD800 && c < 0xDC00 && i + 1 < length
+            && units[i + 1] >= 0xDC00 && units[i + 1] < 0xE000) {
+            c = 0x10000 + ((c - 0xD800) << 10) + (units[i + 1] - 0xDC00);
+            i++;
+        }
+        s.push_back((wchar_t)c);
+    }
+    return s;
+}
+
+
+template <class T>
+void writeSection(FileWriter& out, const std::vector<T>& items) {
+    out.padTo(8);
+    if (!items.empty())
+        out.write(items.data(), items.size() * sizeof(T));
+}
+
+
+ImageStats toImageStats(const CommitStats& stats) {
+    return ImageStats{ stats.linesAdded, stats.linesRemoved, stats.bytes };
+}
+
+
+// Writes every version of history to path. Returns false if the file could not be written
+bool writeCommitImage(const CommitHistory& history, const std::wstring& path) {
+    std::unordered_map<const CommitNode*, uint32_t> nodeIndex;
+    std::unordered_map<const CommitPayload*, uint32_t> payloadIndex;
+    std::vector<const CommitNode*> order;
+
+    // breadth first from the newest root, then whatever only older versions reach
+    auto visit = [&](const std::shared_ptr<CommitNode>& node) {
+        if (node && nodeIndex.insert(std::make_pair(node.get(), (uint32_t)order.size())).second)
+            order.push_back(node.get());
+    };
+    visit(history.latestRoot());
+    size_t scanned = 0;
+    for (int v = history.latestVersion(); v >= 0; v--) {
+        visit(history.rootAt(v));
+        for (; scanned < order.size(); scanned++) {
+            const CommitNode* node = order[scanned];
+            visit(node->left);
+            visit(node->right);
+            for (int m = 0; m < node->leftMods.count.load(std::memory_order_relaxed); m++)
+                visit(node->leftMods.values[m]);
+            for (int m = 0; m < node->rightMods.count.load(std::memory_order_relaxed); m++)
+                visit(node->rightMods.values[m]);
+        }
+    }
+
+    auto indexOf = [&](const std::shared_ptr<CommitNode>& node) {
+        return node ? nodeIndex[node.get()] : IMAGE_NIL;
+    };
+
+    std::vector<ImageNode> nodes;
+    std::vector<ImageChildMod> childMods;
+    std::vector<ImageShapeMod> shapeMods;
+    std::vector<ImagePayload> payloads;
+    std::vector<uint16_t> strings;
+    nodes.reserve(order.size());
+    for (const CommitNode* node : order) {
+        auto found = payloadIndex.find(node->payload.get());
+        if (found == payloadIndex.end()) {
+            const CommitPayload& p = *node->payload;
+            ImagePayload record = ImagePayload();
+            record.fileName = strings.size();
+            appendUtf16(strings, p.fileName);
+            record.fileNameLength = (uint32_t)(strings.size() - record.fileName);
+            record.diffData = strings.size();
+            appendUtf16(strings, p.diffData);
+            record.diffDataLength = (uint32_t)(strings.size() - record.diffData);
+            record.commitMessage = strings.size();
+            appendUtf16(strings, p.commitMessage);
+            record.commitMessageLength = (uint32_t)(strings.size() - record.commitMessage);
+            record.author = strings.size();
+            appendUtf16(strings, p.author);
+            record.authorLength = (uint32_t)(strings.size() - record.author);
+            record.timestamp = p.timestamp;
+            record.stats = toImageStats(p.stats);
+            found = payloadIndex.insert(std::make_pair(node->payload.get(), (uint32_t)payloads.size())).first;
+            payloads.push_back(record);
+        }
+
+        ImageNode record = ImageNode();
+        record.commit = node->commitCounter;
+        record.payload = found->second;
+        record.left = indexOf(node->left);
+        record.right = indexOf(node->right);
+        record.height = node->shape.height;
+        record.size = node->shape.size;
+        record.totals = toImageStats(node->shape.totals);
+        record.firstChildMod = (uint32_t)childMods.size();
+        record.leftMods = (uint16_t)node->leftMods.count.load(std::memory_order_relaxed);
+        record.rightMods = (uint16_t)node->rightMods.count.load(std::memory_order_relaxed);
+        for (int m = 0; m < record.leftMods; m++)
+            childMods.push_back(ImageChildMod{ node->leftMods.versions[m], indexOf(node->leftMods.values[m]) });
+        for (int m = 0; m < record.rightMods; m++)
+            childMods.push_back(ImageChildMod{ node->rightMods.versions[m], indexOf(node->rightMods.values[m]) });
+        record.firstShapeMod = (uint32_t)shapeMods.size();
+        record.shapeMods = (uint32_t)node->shapeMods.count.load(std::memory_order_relaxed);
+        for (uint32_t m = 0; m < record.shapeMods; m++) {
+            const NodeShape& shape = node->shapeMods.values[m];
+            shapeMods.push_back(ImageShapeMod{ node->shapeMods.versions[m], shape.height, shape.size, 0,
+                toImageStats(shape.totals) });
+        }
+        nodes.push_back(record);
+    }
+
+    std::vector<uint32_t> roots;
+    for (int v = 0; v <= history.latestVersion(); v++)
+        roots.push_back(indexOf(history.rootAt(v)));
+
+    // offsets first, every section padded to 8 bytes
+    auto align = [](uint64_t at) { return (at + 7) / 8 * 8; };
+    ImageHeader header = ImageHeader();
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.format = IMAGE_FORMAT;
+    header.nodeCount = (uint32_t)nodes.size();
+    header.childModCount = (uint32_t)childMods.size();
+    header.shapeModCount = (uint32_t)shapeMods.size();
+    header.versionCount = (uint32_t)roots.size();
+    header.payloadCount = (uint32_t)payloads.size();
+    header.nodesOffset = align(sizeof(ImageHeader));
+    header.childModsOffset = align(header.nodesOffset + nodes.size() * sizeof(ImageNode));
+    header.shapeModsOffset = align(header.childModsOffset + childMods.size() * sizeof(ImageChildMod));
+    header.rootsOffset = align(header.shapeModsOffset + shapeMods.size() * sizeof(ImageShapeMod));
+    header.payloadsOffset = align(header.rootsOffset + roots.size() * sizeof(uint32_t));
+    header.stringsOffset = align(header.payloadsOffset + payloads.size() * sizeof(ImagePayload));
+    header.fileBytes = header.stringsOffset + strings.size() * sizeof(uint16_t);
+
+    std::wstring temporary = path + L".tmp";
+    FILE* fp = openFile(temporary, L"wb");
+    if (!fp)
+        return false;
+    FileWriter out(fp);
+    out.write(&header, sizeof(header));
+    writeSection(out, nodes);
+    writeSection(out, childMods);
+    writeSection(out, shapeMods);
+    writeSection(out, roots);
+    writeSection(out, payloads);
+    writeSection(out, strings);
+    bool ok = out.finish();
+    ok = fclose(fp) == 0 && ok;
+    return ok && replaceFile(temporary, path);
+}
+
+
+// A commit image mapped read only. Queries read the mapped nodes in place, opening checks every
+// record once but copies nothing. Mirrors the CommitHistory queries, nodes are indices
+class CommitImage {
+public:
+    typedef uint32_t NodeIndex;
+
+    CommitImage() : header(nullptr), nodes(nullptr), childMods(nullptr),
+        shapeMods(nullptr), roots(nullptr), payloads(nullptr), strings(nullptr) {
+    }
+
+    ~CommitImage() {
+        close();
+    }
+
+    CommitImage(const CommitImage&) = delete;
+    CommitImage& operator=(const CommitImage&) = delete;
+
+    // maps the image at path, false if it is missing or not a valid image
+    bool open(const std::wstring& path) {
+        close();
+        if (!file.open(path))
+            return false;
+        if (file.size() < sizeof(ImageHeader) || !validate()) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        file.close();
+        header = nullptr;
+    }
+
+    bool isOpen() const { return header != nullptr; }
+    size_t fileBytes() const { return file.size(); }
+    size_t nodeCount() const { return header->nodeCount; }
+    int latestVersion() const { return (int)header->versionCount - 1; }
+
+    // root as of version, versions past the newest read the newest
+    NodeIndex rootAt(int version) const {
+        if (version < 0) return roots[0];
+        if (version > latestVersion()) return roots[latestVersion()];
+        return roots[version];
+    }
+
+    int commitOf(NodeIndex node) const { return nodes[node].commit; }
+    long long timeOf(NodeIndex node) const { return payloads[nodes[node].payload].timestamp; }
+
+    NodeIndex getLeft(NodeIndex node, int version) const {
+        const ImageNode& n = nodes[node];
+        return childAt(n.left, n.firstChildMod, n.leftMods, version);
+    }
+
+    NodeIndex getRight(NodeIndex node, int version) const {
+        const ImageNode& n = nodes[node];
+        return childAt(n.right, n.firstChildMod + n.leftMods, n.rightMods, version);
+    }
+
+    int getSize(NodeIndex node, int version) const {
+        if (node == IMAGE_NIL) return 0;
+        const ImageNode& n = nodes[node];
+        for (uint32_t i = n.shapeMods; i > 0; i--) {
+            const ImageShapeMod& mod = shapeMods[n.firstShapeMod + i - 1];
+            if (mod.version <= version)
+                return mod.size;
+        }
+        return n.size;
+    }
+
+    int size(int version) const { return getSize(rootAt(version), version); }
+
+    NodeIndex search(int commit, int version) const {
+        NodeIndex current = rootAt(version);
+        for (int depth = 0; current != IMAGE_NIL && depth < IMAGE_MAX_DEPTH; depth++) {
+            int key = nodes[current].commit;
+            if (commit == key)
+                return current;
+            current = commit < key ? getLeft(current, version) : getRight(current, version);
+        }
+        return IMAGE_NIL;
+    }
+
+    NodeIndex successor(int commit, int version) const {
+        NodeIndex found = IMAGE_NIL;
+        NodeIndex current = rootAt(version);
+        for (int depth = 0; current != IMAGE_NIL && depth < IMAGE_MAX_DEPTH; depth++) {
+            if (commit < nodes[current].commit) {
+                found = current;
+                current = getLeft(current, version);
+            }
+            else {
+                current = getRight(current, version);
+            }
+        }
+        return found;
+    }
+
+    NodeIndex predecessor(int commit, int version) const {
+        NodeIndex found = IMAGE_NIL;
+        NodeIndex current = rootAt(version);
+        for (int depth = 0; current != IMAGE_NIL && depth < IMAGE_MAX_DEPTH; depth++) {
+            if (commit > nodes[current].commit) {
+                found = current;
+                current = getRight(current, version);
+            }
+            else {
+                current = getLeft(current, version);
+            }
+        }
+        return found;
+    }
+
+    // commit at position k (0 based) as of version
+    NodeIndex select(int k, int version) const {
+        NodeIndex current = rootAt(version);
+        for (int depth = 0; current != IMAGE_NIL && depth < IMAGE_MAX_DEPTH; depth++) {
+            NodeIndex left = getLeft(current, version);
+            int leftSize = getSize(left, version);
+            if (k < leftSize) {
+                current = left;
+            }
+            else if (k == leftSize) {
+                return current;
+            }
+            else {
+                k -= leftSize + 1;
+                current = getRight(current, version);
+            }
+        }
+        return IMAGE_NIL;
+    }
+
+    // newest commit recorded at or before time, timestamps never decrease in commit order
+    NodeIndex asOfTime(long long time, int version) const {
+        NodeIndex found = IMAGE_NIL;
+        NodeIndex current = rootAt(version);
+        for (int depth = 0; current != IMAGE_NIL && depth < IMAGE_MAX_DEPTH; depth++) {
+            if (timeOf(current) <= time) {
+                found = current;
+                current = getRight(current, version);
+            }
+            else {
+                current = getLeft(current, version);
+            }
+        }
+        return found;
+    }
+
+    // calls visit(node) for every commit as of version, in commit order. False if it had to stop
+    // on a tree deeper or larger than any real one, the image is damaged
+    template <class Visitor>
+    bool forEach(int version, Visitor visit) const {
+        std::vector<NodeIndex> stack;
+        NodeIndex current = rootAt(version);
+        uint64_t visited = 0;
+        while (current != IMAGE_NIL || !stack.empty()) {
+            while (current != IMAGE_NIL) {
+                if (stack.size() == (size_t)IMAGE_MAX_DEPTH)
+                    return false;
+                stack.push_back(current);
+                current = getLeft(current, version);
+            }
+            if (++visited > header->nodeCount)
+                return false;
+            current = stack.back();
+            stack.pop_back();
+            visit(current);
+            current = getRight(current, version);
+        }
+        return true;
+    }
+
+    // copies the commit's payload out of the image
+    CommitInfo infoOf(NodeIndex node) const {
+        const ImagePayload& p = payloads[nodes[node].payload];
+        CommitInfo info;
+        info.commitNumber = nodes[node].commit;
+        info.fileName = fromUtf16(strings + p.fileName, p.fileNameLength);
+        info.diffData = fromUtf16(strings + p.diffData, p.diffDataLength);
+        info.commitMessage = fromUtf16(strings + p.commitMessage, p.commitMessageLength);
+        info.stats = CommitStats{ p.stats.linesAdded, p.stats.linesRemoved, p.stats.bytes };
+        info.timestamp = p.timestamp;
+        info.author = fromUtf16(strings + p.author, p.authorLength);
+        return info;
+    }
+
+private:
+    NodeIndex childAt(NodeIndex baseChild, uint32_t first, uint32_t count, int version) const {
+        for (uint32_t i = count; i > 0; i--) {
+            const ImageChildMod& mod = childMods[first + i - 1];
+            if (mod.version <= version)
+                return mod.child;
+        }
+        return baseChild;
+    }
+
+    // Every section has to lie inside the file, and every node, mod, root and string reference
+    // inside its section, before anything is read through them. One pass over the records
+    bool validate() {
+        const char* start = file.data();
+        size_t bytes = file.size();
+        const ImageHeader* h = reinterpret_cast<const ImageHeader*>(start);
+        if (memcmp(h->magic, IMAGE_MAGIC, sizeof(h->magic)) != 0 || h->format != IMAGE_FORMAT
+            || h->fileBytes != bytes || h->versionCount == 0)
+            return false;
+        auto fits = [&](uint64_t offset, uint64_t count, uint64_t itemBytes) {
+            return offset % 8 == 0 && offset <= bytes && count <= (bytes - offset) / itemBytes;
+        };
+        if (!fits(h->nodesOffset, h->nodeCount, sizeof(ImageNode))
+            || !fits(h->childModsOffset, h->childModCount, sizeof(ImageChildMod))
+            || !fits(h->shapeModsOffset, h->shapeModCount, sizeof(ImageShapeMod))
+            || !fits(h->rootsOffset, h->versionCount, sizeof(uint32_t))
+            || !fits(h->payloadsOffset, h->payloadCount, sizeof(ImagePayload))
+            || h->stringsOffset > bytes)
+            return false;
+        const ImageNode* n = reinterpret_cast<const ImageNode*>(start + h->nodesOffset);
+        const ImageChildMod* c = reinterpret_cast<const ImageChildMod*>(start + h->childModsOffset);
+        const ImageShapeMod* m = reinterpret_cast<const ImageShapeMod*>(start + h->shapeModsOffset);
+        const uint32_t* r = reinterpret_cast<const uint32_t*>(start + h->rootsOffset);
+        const ImagePayload* p = reinterpret_cast<const ImagePayload*>(start + h->payloadsOffset);
+        const uint16_t* text = reinterpret_cast<const uint16_t*>(start + h->stringsOffset);
+
+        // a damaged length must never get as far as allocating the string it claims
+        uint64_t stringUnits = (bytes - h->stringsOffset) / sizeof(uint16_t);
+        auto isNode = [&](uint32_t index) { return index == IMAGE_NIL || index < h->nodeCount; };
+        auto inStrings = [&](uint64_t offset, uint32_t length) {
+            return offset <= stringUnits && length <= stringUnits - offset;
+        };
+        for (uint32_t i = 0; i < h->versionCount; i++) {
+            if (!isNode(r[i]))
+                return false;
+        }
+        for (uint32_t i = 0; i < h->nodeCount; i++) {
+            const ImageNode& node = n[i];
+            if (node.payload >= h->payloadCount || !isNode(node.left) || !isNode(node.right)
+                || node.size < 1 || (uint32_t)node.size > h->nodeCount
+                || (uint64_t)node.firstChildMod + node.leftMods + node.rightMods > h->childModCount
+                || (uint64_t)node.firstShapeMod + node.shapeMods > h->shapeModCount)
+                return false;
+        }
+        for (uint32_t i = 0; i < h->childModCount; i++) {
+            if (!isNode(c[i].child))
+                return false;
+        }
+        for (uint32_t i = 0; i < h->shapeModCount; i++) {
+            if (m[i].size < 1 || (uint32_t)m[i].size > h->nodeCount)
+                return false;
+        }
+        for (uint32_t i = 0; i < h->payloadCount; i++) {
+            if (!inStrings(p[i].fileName, p[i].fileNameLength) || !inStrings(p[i].diffData, p[i].diffDataLength)
+                || !inStrings(p[i].commitMessage, p[i].commitMessageLength) || !inStrings(p[i].author, p[i].authorLength))
+                return false;
+        }
+        header = h;
+        nodes = n;
+        childMods = c;
+        shapeMods = m;
+        roots = r;
+        payloads = p;
+        strings = text;
+        return true;
+    }
+
+    MappedFile file;
+    const ImageHeader* header;
+    const ImageNode* nodes;
+    const ImageChildMod* childMods;
+    const ImageShapeMod* shapeMods;
+    const uint32_t* roots;
+    const ImagePayload* payloads;
+    const uint16_t* strings;
+};
+
+
+// Changes made since the image was written, replayed on load and then folded into a fresh
+// image. They are the commit and truncate records of the object pack (ObjectPack.h), whose
+// bodies are laid out here.
+enum DeltaRecordType {
+    DELTA_COMMIT = 1,       // body: int32 commit, ImageStats, int64 timestamp, four strings as uint32 length + UTF-16
+    DELTA_TRUNCATE = 2      // body: int32 commit, every commit after it is gone
+};
+
+struct DeltaRecord {
+    uint32_t type;
+    CommitInfo commit;      // only the commit number for DELTA_TRUNCATE
+};
+
+
+// body of a record of type, in UTF-16 units
+std::vector<uint16_t> encodeDeltaBody(uint32_t type, const CommitInfo& commit) {
+    std::vector<uint16_t> body;
+    auto put32 = [&](uint32_t value) {
+        body.push_back((uint16_t)(value & 0xFFFF));
+        body.push_back((uint16_t)(value >> 16));
+    };
+    auto putString = [&](const std::wstring& s) {
+        size_t at = body.size();
+        put32(0);
+        appendUtf16(body, s);
+        uint32_t length = (uint32_t)(body.size() - at - 2);
+        body[at] = (uint16_t)(length & 0xFFFF);
+        body[at + 1] = (uint16_t)(length >> 16);
+    };
+    put32((uint32_t)commit.commitNumber);
+    if (type == DELTA_COMMIT) {
+        const long long numbers[4] = { commit.stats.linesAdded, commit.stats.linesRemoved, commit.stats.bytes,
+            commit.timestamp };
+        for (long long value : numbers) {
+            put32((uint32_t)((unsigned long long)value & 0xFFFFFFFFu));
+            put32((uint32_t)((unsigned long long)value >> 32));
+        }
+        putString(commit.fileName);
+        putString(commit.diffData);
+        putString(commit.commitMessage);
+        putString(commit.author);
+    }
+    return body;
+}
+
+
+// false if body is not a whole record of type
+bool decodeDeltaBody(uint32_t type, const uint16_t* body, size_t units, DeltaRecord& record) {
+    size_t at = 0;
+    bool ok = true;
+    auto get32 = [&]() -> uint32_t {
+        if (at + 2 > units) {
+            ok = false;
+            return 0;
+        }
+        uint32_t value = body[at] | ((uint32_t)body[at + 1] << 16);
+        at += 2;
+        return value;
+    };
+    auto getString = [&]() -> std::wstring {
+        uint32_t length = get32();
+        if (!ok || length > units - at) {
+            ok = false;
+            return std::wstring();
+        }
+        std::wstring s = fromUtf16(body + at, length);
+        at += length;
+        return s;
+    };
+    record.type = type;
+    record.commit.commitNumber = (int)get32();
+    record.commit.stats = CommitStats();
+    record.commit.timestamp = 0;
+    if (type == DELTA_COMMIT) {
+        long long numbers[4];
+        for (long long& value : numbers) {
+            uint32_t low = get32();
+            uint32_t high = get32();
+            value = (long long)(((unsigned long long)high << 32) | low);
+        }
+        record.commit.stats = CommitStats{ numbers[0], numbers[1], numbers[2] };
+        record.commit.timestamp = numbers[3];
+        record.commit.fileName = getString();
+        record.commit.diffData = getString();
+        record.commit.commitMessage = getString();
+        record.commit.author = getString();
+    }
+    else if (type != DELTA_TRUNCATE) {
+        ok = false;
+    }
+    return ok;
+}
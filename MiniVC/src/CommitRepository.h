@@ -0,0 +1,232 @@
+#pragma once
+#include <climits>
+#include <memory>
+#include <vector>
+#include "CommitTree.h"
+
+
+// One version of the tree, frozen. Every method is safe to call from any thread while the
+// snapshot is held: nodes only ever gain mods for versions newer than this one, and those
+// are published with release/acquire ordering (see ModificationLog).
+// Queries hand out plain node pointers and cursors that own nothing, so a reader never holds
+// the last reference to a node. Both are good for as long as the snapshot is held.
+struct CommitSnapshot {
+    std::shared_ptr<CommitNode> root;
+    int version;
+
+    bool empty() const { return !root; }
+    int size() const { return getSize(root, version); }
+
+    const CommitNode* search(int commit) const { return searchCommit(root, commit, version).get(); }
+    const CommitNode* successor(int commit) const { return getSuccessor(root, commit, version).get(); }
+    const CommitNode* predecessor(int commit) const { return getPredecessor(root, commit, version).get(); }
+    const CommitNode* select(int k) const { return selectCommit(root, k, version).get(); }
+    const CommitNode* asOfTime(long long time) const { return latestAtTime(root, time, version).get(); }
+    int rankAtTime(long long time) const { return countBeforeTime(root, time, version); }
+
+    // the cursor points into the tree without owning it, see the aliasing shared_ptr constructor
+    CommitCursor cursor() const { return CommitCursor(std::shared_ptr<CommitNode>(std::shared_ptr<CommitNode>(), root.get()), version); }
+};
+
+
+// Rows of a list over one snapshot, all of its commits or those in a time range. Rows are
+// found by position so the list never has to be built: consecutive rows are one cursor step
+// apart, anything else is an O(log n) seek. Row 0 is the first commit of the range.
+class CommitRows {
+public:
+    CommitRows() = default;
+
+    explicit CommitRows(std::shared_ptr<const CommitSnapshot> source)
+        : snapshot(std::move(source)), count(snapshot->size()), row(snapshot->cursor()) {}
+
+    // narrows the rows to commits made from from to to, both included. LLONG_MIN and LLONG_MAX
+    // leave that end open. Two rank lookups, nothing outside the range is touched
+    void filter(long long from, long long to) {
+        int first = snapshot->rankAtTime(from);
+        int last = to == LLONG_MAX ? snapshot->size() : snapshot->rankAtTime(to + 1);
+        firstRow = first;
+        count = last > first ? last - first : 0;
+        rowPosition = 0;
+        row.seekPosition(firstRow);
+    }
+
+    int size() const { return count; }
+    const CommitSnapshot& source() const { return *snapshot; }
+
+    // commit on row position, nullptr outside the range
+    const CommitNode* at(int position) {
+        if (position < 0 || position >= count)
+            return nullptr;
+        bool found;
+        if (row.valid() && position == rowPosition)
+            found = true;
+        else if (row.valid() && position == rowPosition + 1)
+            found = row.next();
+        else if (row.valid() && position == rowPosition - 1)
+            found = row.prev();
+        else
+            found = row.seekPosition(firstRow + position);
+        rowPosition = position;
+        return found ? &row.node() : nullptr;
+    }
+
+private:
+    std::shared_ptr<const CommitSnapshot> snapshot;
+    int firstRow = 0;            // position of row 0 in the snapshot
+    int count = 0;
+    CommitCursor row;            // last row handed out, scrolling just steps it
+    int rowPosition = 0;
+};
+
+
+// Repository handle shared between one writer and any number of reader threads.
+//
+// Readers call snapshot() and work on what they get without taking a lock. The writer
+// changes the history through the methods below, each of which publishes the new root
+// atomically when it is done.
+//
+// Nodes are only freed on the writer thread. Readers get node pointers and cursors that own
+// nothing, and every snapshot published is also kept by the writer until no reader holds it,
+// so the last reference to a node is always dropped here. The node destructor touches the
+// arena and the counters, neither of which is thread safe.
+// reset() retires the whole history instead of clearing it, and reclaim() frees a retired
+// history only once none of the snapshots taken from it are held any more.
+class CommitRepository {
+public:
+    CommitRepository() : current(new CommitHistory) {
+        publish();
+    }
+
+    ~CommitRepository() {
+        std::atomic_store(&published, std::shared_ptr<const CommitSnapshot>());
+        for (auto& snap : handedOut)
+            dropSnapshot(snap);
+        for (auto& old : retired) {
+            for (auto& snap : old.snapshots)
+                dropSnapshot(snap);
+        }
+    }
+
+    CommitRepository(const CommitRepository&) = delete;
+    CommitRepository& operator=(const CommitRepository&) = delete;
+
+    // reader side, any thread
+    std::shared_ptr<const CommitSnapshot> snapshot() const {
+        return std::atomic_load(&published);
+    }
+
+    // writer side, one thread at a time. Reading the history directly is fine on that thread
+    const CommitHistory& history() const { return *current; }
+
+    int insert(int commitCounter, const std::wstring& fileName, const std::wstring& diffData,
+        const std::wstring& commitMessage = L"", const CommitStats& stats = CommitStats(),
+        long long timestamp = 0, const std::wstring& author = L"") {
+        int version = current->insert(commitCounter, fileName, diffData, commitMessage, stats, timestamp, author);
+        publish();
+        return version;
+    }
+
+    int truncateAfter(int commit) {
+        int version = current->truncateAfter(commit);
+        publish();
+        return version;
+    }
+
+    int bulkLoad(std::vector<CommitInfo> commits) {
+        int version = current->bulkLoad(std::move(commits));
+        publish();
+        return version;
+    }
+
+    // drops every version but keep and the newest, see CommitHistory::compact.
+    // Nodes still read through a snapshot are freed once that snapshot is let go
+    CompactionReport compact(const std::vector<int>& keep) {
+        CompactionReport report = current->compact(keep);
+        publish();
+        return report;
+    }
+
+    // starts over with an empty history. The old one is retired, not freed, readers may still hold it
+    void reset() {
+        Retired old;
+        old.history = std::move(current);
+        current.reset(new CommitHistory);
+        publish();
+        // every snapshot handed out so far, the one publish() just replaced included, reads the old history
+        old.snapshots = std::move(handedOut);
+        handedOut.clear();
+        prunedSize = 0;
+        retired.push_back(std::move(old));
+        reclaim();
+    }
+
+    // frees the retired histories nobody reads any more, returns how many are still waiting
+    size_t reclaim() {
+        for (size_t i = 0; i < retired.size(); ) {
+            if (!stillRead(retired[i].snapshots)) {
+                // snapshots go first, the history then tears every node down iteratively
+                for (auto& snap : retired[i].snapshots)
+                    dropSnapshot(snap);
+                retired[i].snapshots.clear();
+                retired[i].history.reset();
+                retired[i] = std::move(retired.back());
+                retired.pop_back();
+            }
+            else {
+                i++;
+            }
+        }
+        return retired.size();
+    }
+
+private:
+    struct Retired {
+        std::unique_ptr<CommitHistory> history;
+        std::vector<std::shared_ptr<const CommitSnapshot>> snapshots;
+    };
+
+    // a snapshot that is no longer published can't be picked up again, so once the
+    // writer holds the only reference it stays that way
+    static bool stillRead(const std::vector<std::shared_ptr<const CommitSnapshot>>& snapshots) {
+        for (const auto& snap : snapshots) {
+            if (snap.use_count() > 1)
+                return true;
+        }
+        return false;
+    }
+
+    // after a compaction the snapshot may hold the last reference to an old tree, free it without recursing
+    static void dropSnapshot(std::shared_ptr<const CommitSnapshot>& snap) {
+        std::vector<std::shared_ptr<CommitNode>> pending(1, snap->root);
+        snap.reset();
+        releaseNodes(pending);
+    }
+
+    void publish() {
+        std::shared_ptr<const CommitSnapshot> next = std::make_shared<const CommitSnapshot>(
+            CommitSnapshot{ current->latestRoot(), current->latestVersion() });
+        std::shared_ptr<const CommitSnapshot> previous = std::atomic_exchange(&published, next);
+
+        // keep what readers may still hold so the snapshot dies here, never on a reader thread.
+        // Drops the ones nobody holds once the list has doubled, amortized O(1) per publish
+        if (previous)
+            handedOut.push_back(std::move(previous));
+        if (handedOut.size() >= 2 * prunedSize + 16) {
+            size_t kept = 0;
+            for (size_t i = 0; i < handedOut.size(); i++) {
+                if (handedOut[i].use_count() == 1)
+                    dropSnapshot(handedOut[i]);
+                else
+                    handedOut[kept++] = std::move(handedOut[i]);
+            }
+            handedOut.resize(kept);
+            prunedSize = kept;
+        }
+    }
+
+    std::unique_ptr<CommitHistory> current;
+    std::shared_ptr<const CommitSnapshot> published;    // only touched through std::atomic_* calls
+    std::vector<std::shared_ptr<const CommitSnapshot>> handedOut;
+    size_t prunedSize = 0;
+    std::vector<Retired> retired;
+};
@@ -1,17 +1,103 @@
 #pragma once
 #include <memory>
 #include <string>
-#include <windows.h>
 #include <algorithm>
+#include <atomic>
 #include <vector>
+#include <climits>
+#include <map>
+#include <unordered_set>
+#include "NodeArena.h"
 #undef max
 
+// Numeric change statistics of a commit, summed per subtree for range queries
+struct CommitStats {
+    long long linesAdded;
+    long long linesRemoved;
+    long long bytes;
+};
+
+CommitStats operator+(const CommitStats& a, const CommitStats& b) {
+    return CommitStats{ a.linesAdded + b.linesAdded, a.linesRemoved + b.linesRemoved, a.bytes + b.bytes };
+}
+
+CommitStats operator-(const CommitStats& a, const CommitStats& b) {
+    return CommitStats{ a.linesAdded - b.linesAdded, a.linesRemoved - b.linesRemoved, a.bytes - b.bytes };
+}
+
+bool operator==(const CommitStats& a, const CommitStats& b) {
+    return a.linesAdded == b.linesAdded && a.linesRemoved == b.linesRemoved && a.bytes == b.bytes;
+}
+
+
 // Relevant information stored in a commit
 struct CommitInfo {
     int commitNumber;
     std::wstring fileName;
     std::wstring diffData;
     std::wstring commitMessage;
+    CommitStats stats;
+    long long timestamp;        // seconds since 1970 UTC, never earlier than the commit before
+    std::wstring author;        // empty when unknown
+};
+
+
+// Counters for the commit tree, used to check that tree restructuring never copies payloads
+// and to size memory budgets. They cover every history in the process, building with
+// MINIVC_NO_COUNTERS compiles all of them out
+struct TreeCounters {
+    size_t payloadsCreated;
+    size_t payloadCopies;
+    size_t nodeCopies;      // full copies, a mod log ran out or a node was rebuilt by a join
+    size_t rotations;
+    size_t nodesAllocated;
+    size_t nodesFreed;      // the nodes alive are the difference
+    size_t modsLogged;      // changes that went into a mod slot instead of a copy
+    size_t inserts;
+    size_t payloadBytes;    // payload structs and their strings as created
+};
+
+TreeCounters& treeCounters() {
+    static TreeCounters counters = { 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    return counters;
+}
+
+#ifdef MINIVC_NO_COUNTERS
+#define MINIVC_COUNT(field, amount) ((void)0)
+#else
+#define MINIVC_COUNT(field, amount) (treeCounters().field += (amount))
+#endif
+
+
+// Immutable commit data, stored once per commit and shared by every copy of its node
+struct CommitPayload {
+    std::wstring fileName;
+    std::wstring diffData;
+    std::wstring commitMessage;
+    CommitStats stats;
+    long long timestamp;
+    std::wstring author;
+
+    CommitPayload(const std::wstring& fname, const std::wstring& diff, const std::wstring& msg,
+        const CommitStats& commitStats, long long time, const std::wstring& who)
+        : fileName(fname), diffData(diff), commitMessage(msg), stats(commitStats), timestamp(time), author(who) {
+        MINIVC_COUNT(payloadsCreated, 1);
+        MINIVC_COUNT(payloadBytes, footprint());
+    }
+
+    CommitPayload(const CommitPayload& other)
+        : fileName(other.fileName), diffData(other.diffData), commitMessage(other.commitMessage),
+        stats(other.stats), timestamp(other.timestamp), author(other.author) {
+        MINIVC_COUNT(payloadCopies, 1);
+    }
+
+    CommitPayload& operator=(const CommitPayload&) = delete;
+
+    // bytes held by the payload, the strings' buffers included
+    size_t footprint() const {
+        return sizeof(CommitPayload) + (fileName.capacity() + diffData.capacity() +
+            commitMessage.capacity() + author.capacity()) * sizeof(wchar_t);
+    }
 };
 
 
@@ -19,115 +105,190 @@ struct CommitInfo {
 struct CommitNode;
 
 
-// The "Mods" Stored in the Partially persistent AVL Tree
-struct ModificationRecord {
-    enum Field { LEFT, RIGHT, HEIGHT };
-    int version;      // commit
-    Field field;
-    std::shared_ptr<CommitNode> newChild;
-    int newHeight;
+// The "Mods" Stored in the Partially persistent AVL Tree. Each field of a node keeps its
+// own log, appended in version order, so a lookup walks back from the newest entry and
+// stops at the first one that is not newer than the version asked for.
+// Only the writer appends; count is stored after the entry is written, so a reader on
+// another thread sees either the old count or a complete new entry (CommitRepository)
+template <class T, int Capacity>
+struct ModificationLog {
+    int versions[Capacity];
+    T values[Capacity];
+    std::atomic<int> count;
 
-    // default constructor
-    ModificationRecord()
-        : version(0), field(LEFT), newChild(nullptr), newHeight(0) {
-    }
+    ModificationLog() : count(0) {}
+
+    bool full() const { return count.load(std::memory_order_relaxed) == Capacity; }
 
-    // pointer modifications
-    ModificationRecord(int ver, Field f, std::shared_ptr<CommitNode> child)
-        : version(ver), field(f), newChild(child), newHeight(0) {
+    void append(int version, const T& value) {
+        int n = count.load(std::memory_order_relaxed);
+        versions[n] = version;
+        values[n] = value;
+        count.store(n + 1, std::memory_order_release);
     }
 
-    // height modification
-    ModificationRecord(int ver, Field f, int h)
-        : version(ver), field(f), newChild(nullptr), newHeight(h) {
+    // value as of version, or base if every entry is newer
+    const T& at(const T& base, int version) const {
+        int i = count.load(std::memory_order_acquire);
+        while (i > 0 && versions[i - 1] > version)
+            i--;
+        return i == 0 ? base : values[i - 1];
     }
 };
 
 
-// A commit node in the partially persistent AVL tree. Uses fat node approach from Driscoll with a fixed mod list
+// Height, subtree size and summed stats of a node. They all change together on insert, so they share one log
+struct NodeShape {
+    int height;
+    int size;
+    CommitStats totals;
+};
+
+
+// Mod slots per field of a node. More slots mean fewer node copies but wider nodes, build the
+// benchmark with a different value to compare (-DMINIVC_MAX_MODS=5)
+#ifndef MINIVC_MAX_MODS
+#define MINIVC_MAX_MODS 3
+#endif
+static_assert(MINIVC_MAX_MODS >= 1, "a node needs at least one mod slot per field");
+
+
+// A commit node in the partially persistent AVL tree. Uses fat node approach from Driscoll with a fixed mod list per field
 struct CommitNode {
     int commitCounter;
-    std::wstring fileName;
-    std::wstring diffData;
-    std::wstring commitMessage;
-    int height;
+    std::shared_ptr<const CommitPayload> payload;
+    NodeShape shape;
     std::shared_ptr<CommitNode> left;
     std::shared_ptr<CommitNode> right;
 
-    // Fat node fields
-    static const int MAX_MODS = 5;
-    ModificationRecord mods[MAX_MODS];
-    int modCount;
+    // Fat node fields, a full log on any field triggers a node copy
+    static const int MAX_MODS = MINIVC_MAX_MODS;
+    ModificationLog<std::shared_ptr<CommitNode>, MAX_MODS> leftMods;
+    ModificationLog<std::shared_ptr<CommitNode>, MAX_MODS> rightMods;
+    ModificationLog<NodeShape, MAX_MODS> shapeMods;
 
-    CommitNode(int counter, const std::wstring& fname, const std::wstring& diff = L"", const std::wstring& msg = L"")
-        : commitCounter(counter), fileName(fname), diffData(diff), commitMessage(msg),
-        height(1), left(nullptr), right(nullptr), modCount(0) {
+    CommitNode(int counter, std::shared_ptr<const CommitPayload> data)
+        : commitCounter(counter), payload(std::move(data)),
+        left(nullptr), right(nullptr) {
+        shape.height = 1;
+        shape.size = 1;
+        shape.totals = payload->stats;
+        MINIVC_COUNT(nodesAllocated, 1);
     }
+
+    ~CommitNode() {
+        MINIVC_COUNT(nodesFreed, 1);
+    }
+};
+
+
+// Left, right, height and size of a node as they were at one version
+struct NodeView {
+    const std::shared_ptr<CommitNode>& left;
+    const std::shared_ptr<CommitNode>& right;
+    NodeShape shape;
 };
 
 
+// Every node of the tree is created here so it lands in the arena of the history it belongs to
+std::shared_ptr<CommitNode> makeCommitNode(NodeArena& arena, int counter, const std::shared_ptr<const CommitPayload>& payload) {
+#ifdef MINIVC_HEAP_NODES
+    (void)arena;
+    return std::make_shared<CommitNode>(counter, payload);
+#else
+    return std::allocate_shared<CommitNode>(ArenaAllocator<CommitNode>(arena), counter, payload);
+#endif
+}
+
+
+// Payloads are built once when the commit is inserted
+std::shared_ptr<const CommitPayload> makeCommitPayload(NodeArena& arena, const std::wstring& fname,
+    const std::wstring& diff, const std::wstring& msg, const CommitStats& stats = CommitStats(),
+    long long timestamp = 0, const std::wstring& author = L"") {
+#ifdef MINIVC_HEAP_NODES
+    (void)arena;
+    return std::make_shared<const CommitPayload>(fname, diff, msg, stats, timestamp, author);
+#else
+    return std::allocate_shared<const CommitPayload>(ArenaAllocator<CommitPayload>(arena),
+        fname, diff, msg, stats, timestamp, author);
+#endif
+}
+
+
+// Shared empty child so the getters can hand out references
+const std::shared_ptr<CommitNode>& nullNode() {
+    static const std::shared_ptr<CommitNode> none;
+    return none;
+}
+
+
 // Return a node with most up to date fields based off mod list
-std::shared_ptr<CommitNode> getLeft(const std::shared_ptr<CommitNode>& node, int version) {
-    if (!node) return nullptr;
-    std::shared_ptr<CommitNode> result = node->left;
-    for (int i = 0; i < node->modCount; i++) {
-        if (node->mods[i].field == ModificationRecord::LEFT && node->mods[i].version <= version) {
-            result = node->mods[i].newChild;
-        }
-    }
-    return result;
+const std::shared_ptr<CommitNode>& getLeft(const std::shared_ptr<CommitNode>& node, int version) {
+    if (!node) return nullNode();
+    return node->leftMods.at(node->left, version);
 }
 
 
 // Return a node with most up to date fields based off mod list
-std::shared_ptr<CommitNode> getRight(const std::shared_ptr<CommitNode>& node, int version) {
-    if (!node) return nullptr;
-    std::shared_ptr<CommitNode> result = node->right;
-    for (int i = 0; i < node->modCount; i++) {
-        if (node->mods[i].field == ModificationRecord::RIGHT && node->mods[i].version <= version) {
-            result = node->mods[i].newChild;
-        }
-    }
-    return result;
+const std::shared_ptr<CommitNode>& getRight(const std::shared_ptr<CommitNode>& node, int version) {
+    if (!node) return nullNode();
+    return node->rightMods.at(node->right, version);
 }
 
 
 // Return height of node using mod list to get most up to date information
 int getHeight(const std::shared_ptr<CommitNode>& node, int version) {
     if (!node) return 0;
-    int result = node->height;
-    for (int i = 0; i < node->modCount; i++) {
-        if (node->mods[i].field == ModificationRecord::HEIGHT && node->mods[i].version <= version) {
-            result = node->mods[i].newHeight;
-        }
-    }
-    return result;
+    return node->shapeMods.at(node->shape, version).height;
+}
+
+
+// Return the number of commits in the subtree of node as of version
+int getSize(const std::shared_ptr<CommitNode>& node, int version) {
+    if (!node) return 0;
+    return node->shapeMods.at(node->shape, version).size;
+}
+
+
+// Return the stats summed over the subtree of node as of version
+CommitStats getTotals(const std::shared_ptr<CommitNode>& node, int version) {
+    if (!node) return CommitStats();
+    return node->shapeMods.at(node->shape, version).totals;
+}
+
+
+// Resolve left, right, height and size in one call, node must not be null
+NodeView resolveNode(const std::shared_ptr<CommitNode>& node, int version) {
+    return NodeView{ node->leftMods.at(node->left, version),
+        node->rightMods.at(node->right, version),
+        node->shapeMods.at(node->shape, version) };
 }
 
 
 // full mod list triggers a new node and leaves old node alone
-std::shared_ptr<CommitNode> copyFullNode(const std::shared_ptr<CommitNode>& node, int version) {
+std::shared_ptr<CommitNode> copyFullNode(NodeArena& arena, const std::shared_ptr<CommitNode>& node, int version) {
     if (!node) return nullptr;
-    auto newNode = std::make_shared<CommitNode>(node->commitCounter, node->fileName, node->diffData, node->commitMessage);
-    newNode->left = getLeft(node, version);
-    newNode->right = getRight(node, version);
-    newNode->height = getHeight(node, version);
-    newNode->modCount = 0;
+    MINIVC_COUNT(nodeCopies, 1);
+    auto newNode = makeCommitNode(arena, node->commitCounter, node->payload);
+    NodeView view = resolveNode(node, version);
+    newNode->left = view.left;
+    newNode->right = view.right;
+    newNode->shape = view.shape;
     return newNode;
 }
 
 
 // updates the left child node, triggers a copy if mod list is full
-std::shared_ptr<CommitNode> updateLeft(const std::shared_ptr<CommitNode>& node,
+std::shared_ptr<CommitNode> updateLeft(NodeArena& arena, const std::shared_ptr<CommitNode>& node,
     const std::shared_ptr<CommitNode>& newLeft, int version) {
     if (!node) return nullptr;
-    if (node->modCount < CommitNode::MAX_MODS) {
-        node->mods[node->modCount] = ModificationRecord(version, ModificationRecord::LEFT, newLeft);
-        node->modCount++;
+    if (!node->leftMods.full()) {
+        node->leftMods.append(version, newLeft);
+        MINIVC_COUNT(modsLogged, 1);
         return node;
     }
     else {
-        auto newNode = copyFullNode(node, version);
+        auto newNode = copyFullNode(arena, node, version);
         newNode->left = newLeft;
         return newNode;
     }
@@ -135,110 +296,127 @@ std::shared_ptr<CommitNode> updateLeft(const std::shared_ptr<CommitNode>& node,
 
 
 // updates the right child node, triggers a copy if mod list is full
-std::shared_ptr<CommitNode> updateRight(const std::shared_ptr<CommitNode>& node,
+std::shared_ptr<CommitNode> updateRight(NodeArena& arena, const std::shared_ptr<CommitNode>& node,
     const std::shared_ptr<CommitNode>& newRight, int version) {
     if (!node) return nullptr;
-    if (node->modCount < CommitNode::MAX_MODS) {
-        node->mods[node->modCount] = ModificationRecord(version, ModificationRecord::RIGHT, newRight);
-        node->modCount++;
+    if (!node->rightMods.full()) {
+        node->rightMods.append(version, newRight);
+        MINIVC_COUNT(modsLogged, 1);
         return node;
     }
     else {
-        auto newNode = copyFullNode(node, version);
+        auto newNode = copyFullNode(arena, node, version);
         newNode->right = newRight;
         return newNode;
     }
 }
 
 
-// updates the height of a node, triggers a copy if mod list is full
-std::shared_ptr<CommitNode> updateHeight(const std::shared_ptr<CommitNode>& node,
-    int version, int newHeight) {
+// updates the height and size of a node, triggers a copy if mod list is full
+std::shared_ptr<CommitNode> updateShape(NodeArena& arena, const std::shared_ptr<CommitNode>& node,
+    int version, const NodeShape& newShape) {
     if (!node) return nullptr;
-    if (node->modCount < CommitNode::MAX_MODS) {
-        node->mods[node->modCount] = ModificationRecord(version, ModificationRecord::HEIGHT, newHeight);
-        node->modCount++;
+    if (!node->shapeMods.full()) {
+        node->shapeMods.append(version, newShape);
+        MINIVC_COUNT(modsLogged, 1);
         return node;
     }
     else {
-        auto newNode = copyFullNode(node, version);
-        newNode->height = newHeight;
+        auto newNode = copyFullNode(arena, node, version);
+        newNode->shape = newShape;
         return newNode;
     }
 }
 
 
-// Perform a right rotation to rebalance tree, leaves old nodes as is and creates new nodes
-std::shared_ptr<CommitNode> rightRotate(const std::shared_ptr<CommitNode>& y, int version) {
-    auto x = copyFullNode(getLeft(y, version), version);
-    auto T2 = getRight(x, version);
-    auto newY = updateLeft(y, T2, version);
-    newY = updateHeight(newY, version, 1 + std::max(getHeight(getLeft(newY, version), version),
-        getHeight(getRight(newY, version), version)));
-    x = updateRight(x, newY, version);
-    x = updateHeight(x, version, 1 + std::max(getHeight(getLeft(x, version), version),
-        getHeight(getRight(x, version), version)));
-    return x;
+// recomputes height, size and totals from the children, only logs a mod when any changed
+std::shared_ptr<CommitNode> refreshHeight(NodeArena& arena, const std::shared_ptr<CommitNode>& node, int version) {
+    NodeView view = resolveNode(node, version);
+    NodeShape newShape;
+    newShape.height = 1 + std::max(getHeight(view.left, version), getHeight(view.right, version));
+    newShape.size = 1 + getSize(view.left, version) + getSize(view.right, version);
+    newShape.totals = getTotals(view.left, version) + node->payload->stats + getTotals(view.right, version);
+    if (newShape.height == view.shape.height && newShape.size == view.shape.size
+        && newShape.totals == view.shape.totals)
+        return node;
+    return updateShape(arena, node, version, newShape);
+}
+
+
+// Perform a right rotation to rebalance tree. The node moving up is copied: linking the old
+// node to its former parent through a mod would make a shared_ptr cycle that is never freed
+std::shared_ptr<CommitNode> rightRotate(NodeArena& arena, const std::shared_ptr<CommitNode>& y, int version) {
+    MINIVC_COUNT(rotations, 1);
+    auto x = copyFullNode(arena, getLeft(y, version), version);
+    auto newY = updateLeft(arena, y, getRight(x, version), version);
+    newY = refreshHeight(arena, newY, version);
+    x = updateRight(arena, x, newY, version);
+    return refreshHeight(arena, x, version);
 }
 
 
 // Performs a left rotation to rebalance tree
-std::shared_ptr<CommitNode> leftRotate(const std::shared_ptr<CommitNode>& x, int version) {
-    auto y = copyFullNode(getRight(x, version), version);
-    auto T2 = getLeft(y, version);
-    auto newX = updateRight(x, T2, version);
-    newX = updateHeight(newX, version, 1 + std::max(getHeight(getLeft(newX, version), version),
-        getHeight(getRight(newX, version), version)));
-    y = updateLeft(y, newX, version);
-    y = updateHeight(y, version, 1 + std::max(getHeight(getLeft(y, version), version),
-        getHeight(getRight(y, version), version)));
-    return y;
-}
-
-//adding a new node to the commit tree, performs balance checks and balances accordingly
-std::shared_ptr<CommitNode> insertNode(const std::shared_ptr<CommitNode>& root, int commitCounter,
-    const std::wstring& fileName, const std::wstring& diffData,
-    const std::wstring& commitMessage = L"") {
-    int version = commitCounter;  // Each new insertion uses its commit number as its version.
+std::shared_ptr<CommitNode> leftRotate(NodeArena& arena, const std::shared_ptr<CommitNode>& x, int version) {
+    MINIVC_COUNT(rotations, 1);
+    auto y = copyFullNode(arena, getRight(x, version), version);
+    auto newX = updateRight(arena, x, getLeft(y, version), version);
+    newX = refreshHeight(arena, newX, version);
+    y = updateLeft(arena, y, newX, version);
+    return refreshHeight(arena, y, version);
+}
+
+//adding a new node to the commit tree, performs balance checks and balances accordingly.
+//version has to be newer than every version already written into the tree
+std::shared_ptr<CommitNode> insertNode(NodeArena& arena, const std::shared_ptr<CommitNode>& root, int commitCounter,
+    const std::shared_ptr<const CommitPayload>& payload, int version) {
     if (!root)
-        return std::make_shared<CommitNode>(commitCounter, fileName, diffData, commitMessage);
+        return makeCommitNode(arena, commitCounter, payload);
 
-    // Copy the root using its effective fields for the current version.
-    auto newRoot = copyFullNode(root, version);
-    if (commitCounter < newRoot->commitCounter) {
-        auto updatedLeft = insertNode(getLeft(newRoot, version), commitCounter, fileName, diffData, commitMessage);
-        newRoot = updateLeft(newRoot, updatedLeft, version);
+    // nodes are changed through their mod logs, only nodes whose logs are full get copied
+    std::shared_ptr<CommitNode> newRoot = root;
+    if (commitCounter < root->commitCounter) {
+        auto updatedLeft = insertNode(arena, getLeft(root, version), commitCounter, payload, version);
+        if (updatedLeft != getLeft(root, version))
+            newRoot = updateLeft(arena, root, updatedLeft, version);
     }
     else {
-        auto updatedRight = insertNode(getRight(newRoot, version), commitCounter, fileName, diffData, commitMessage);
-        newRoot = updateRight(newRoot, updatedRight, version);
+        auto updatedRight = insertNode(arena, getRight(root, version), commitCounter, payload, version);
+        if (updatedRight != getRight(root, version))
+            newRoot = updateRight(arena, root, updatedRight, version);
     }
-    int newHeight = 1 + std::max(getHeight(getLeft(newRoot, version), version), getHeight(getRight(newRoot, version), version));
-    newRoot = updateHeight(newRoot, version, newHeight);
+    newRoot = refreshHeight(arena, newRoot, version);
 
     int balance = getHeight(getLeft(newRoot, version), version) - getHeight(getRight(newRoot, version), version);
 
     // left left
     if (balance > 1 && commitCounter < getLeft(newRoot, version)->commitCounter)
-        return rightRotate(newRoot, version);
+        return rightRotate(arena, newRoot, version);
     // right right
     if (balance < -1 && commitCounter >= getRight(newRoot, version)->commitCounter)
-        return leftRotate(newRoot, version);
+        return leftRotate(arena, newRoot, version);
     // left right 
     if (balance > 1 && commitCounter >= getLeft(newRoot, version)->commitCounter) {
-        auto updatedLeft = leftRotate(getLeft(newRoot, version), version);
-        newRoot = updateLeft(newRoot, updatedLeft, version);
-        return rightRotate(newRoot, version);
+        auto updatedLeft = leftRotate(arena, getLeft(newRoot, version), version);
+        newRoot = updateLeft(arena, newRoot, updatedLeft, version);
+        return rightRotate(arena, newRoot, version);
     }
     // right left 
     if (balance < -1 && commitCounter < getRight(newRoot, version)->commitCounter) {
-        auto updatedRight = rightRotate(getRight(newRoot, version), version);
-        newRoot = updateRight(newRoot, updatedRight, version);
-        return leftRotate(newRoot, version);
+        auto updatedRight = rightRotate(arena, getRight(newRoot, version), version);
+        newRoot = updateRight(arena, newRoot, updatedRight, version);
+        return leftRotate(arena, newRoot, version);
     }
     return newRoot;
 }
 
+//adding a new commit when every commit gets its own version, its commit number.
+//the payload is built once here and shared by every later copy of the node
+std::shared_ptr<CommitNode> insertNode(NodeArena& arena, const std::shared_ptr<CommitNode>& root, int commitCounter,
+    const std::wstring& fileName, const std::wstring& diffData,
+    const std::wstring& commitMessage = L"") {
+    return insertNode(arena, root, commitCounter, makeCommitPayload(arena, fileName, diffData, commitMessage), commitCounter);
+}
+
 //returns a commit node with the desired commit version
 std::shared_ptr<CommitNode> searchCommit(const std::shared_ptr<CommitNode>& node, int targetCommit, int version) {
     if (!node) return nullptr;
@@ -252,32 +430,938 @@ std::shared_ptr<CommitNode> searchCommit(const std::shared_ptr<CommitNode>& node
 
 //returns the commit after this current commit that is viewed
 std::shared_ptr<CommitNode> getSuccessor(const std::shared_ptr<CommitNode>& root, int commitNumber, int version) {
-    std::shared_ptr<CommitNode> successor = nullptr;
-    auto current = root;
-    while (current) {
-        if (commitNumber < current->commitCounter) {
+    const std::shared_ptr<CommitNode>* successor = &nullNode();
+    const std::shared_ptr<CommitNode>* current = &root;
+    while (*current) {
+        if (commitNumber < (*current)->commitCounter) {
             successor = current;
-            current = getLeft(current, version);
+            current = &getLeft(*current, version);
         }
         else {
-            current = getRight(current, version);
+            current = &getRight(*current, version);
         }
     }
-    return successor;
+    return *successor;
 }
 
 //returns the commit before this current commit that is viewed
 std::shared_ptr<CommitNode> getPredecessor(const std::shared_ptr<CommitNode>& root, int commitNumber, int version) {
-    std::shared_ptr<CommitNode> predecessor = nullptr;
-    auto current = root;
-    while (current) {
-        if (commitNumber > current->commitCounter) {
+    const std::shared_ptr<CommitNode>* predecessor = &nullNode();
+    const std::shared_ptr<CommitNode>* current = &root;
+    while (*current) {
+        if (commitNumber > (*current)->commitCounter) {
             predecessor = current;
-            current = getRight(current, version);
+            current = &getRight(*current, version);
+        }
+        else {
+            current = &getLeft(*current, version);
+        }
+    }
+    return *predecessor;
+}
+
+//returns the commit at position k (0 based, in commit order), null if k is out of range
+std::shared_ptr<CommitNode> selectCommit(const std::shared_ptr<CommitNode>& root, int k, int version) {
+    const std::shared_ptr<CommitNode>* current = &root;
+    while (*current) {
+        NodeView view = resolveNode(*current, version);
+        int leftSize = getSize(view.left, version);
+        if (k < leftSize) {
+            current = &view.left;
+        }
+        else if (k == leftSize) {
+            return *current;
+        }
+        else {
+            k -= leftSize + 1;
+            current = &view.right;
+        }
+    }
+    return nullptr;
+}
+
+//returns how many commits are smaller than commitNumber, or not larger when inclusive
+int rankCommit(const std::shared_ptr<CommitNode>& root, int commitNumber, int version, bool inclusive = false) {
+    int rank = 0;
+    const std::shared_ptr<CommitNode>* current = &root;
+    while (*current) {
+        NodeView view = resolveNode(*current, version);
+        int key = (*current)->commitCounter;
+        if (commitNumber > key || (inclusive && commitNumber == key)) {
+            rank += getSize(view.left, version) + 1;
+            current = &view.right;
+        }
+        else {
+            current = &view.left;
+        }
+    }
+    return rank;
+}
+
+//returns the stats summed over every commit smaller than commitNumber, or not larger when inclusive
+CommitStats statsBelow(const std::shared_ptr<CommitNode>& root, int commitNumber, int version, bool inclusive = false) {
+    CommitStats total = CommitStats();
+    const std::shared_ptr<CommitNode>* current = &root;
+    while (*current) {
+        NodeView view = resolveNode(*current, version);
+        int key = (*current)->commitCounter;
+        if (commitNumber > key || (inclusive && commitNumber == key)) {
+            total = total + getTotals(view.left, version) + (*current)->payload->stats;
+            current = &view.right;
+        }
+        else {
+            current = &view.left;
+        }
+    }
+    return total;
+}
+
+
+// Timestamps never decrease in commit order (CommitHistory keeps them that way), so the commit
+// tree is also the time index and both lookups below are one O(log n) walk.
+
+//returns the newest commit recorded at or before time, null if there is none
+std::shared_ptr<CommitNode> latestAtTime(const std::shared_ptr<CommitNode>& root, long long time, int version) {
+    const std::shared_ptr<CommitNode>* found = &nullNode();
+    const std::shared_ptr<CommitNode>* current = &root;
+    while (*current) {
+        if ((*current)->payload->timestamp <= time) {
+            found = current;
+            current = &getRight(*current, version);
+        }
+        else {
+            current = &getLeft(*current, version);
+        }
+    }
+    return *found;
+}
+
+//returns how many commits were recorded before time, the position of the first one at or after it
+int countBeforeTime(const std::shared_ptr<CommitNode>& root, long long time, int version) {
+    int rank = 0;
+    const std::shared_ptr<CommitNode>* current = &root;
+    while (*current) {
+        NodeView view = resolveNode(*current, version);
+        if ((*current)->payload->timestamp < time) {
+            rank += getSize(view.left, version) + 1;
+            current = &view.right;
         }
         else {
-            current = getLeft(current, version);
+            current = &view.left;
         }
     }
-    return predecessor;
-}
\ No newline at end of file
+    return rank;
+}
+
+
+// Split and join build the new version out of fresh nodes and whole subtrees of the old one,
+// old nodes never get a mod pointing at a fresh node. So an old node never becomes the child of
+// its former descendant, which would make a shared_ptr cycle, and every older version stays intact.
+// Their inputs have to be trees as of version, ie. the newest tree or pieces cut from it.
+
+// fresh node for the commit in source with the given children
+std::shared_ptr<CommitNode> makeJoinedNode(NodeArena& arena, const std::shared_ptr<CommitNode>& source,
+    const std::shared_ptr<CommitNode>& left, const std::shared_ptr<CommitNode>& right, int version) {
+    MINIVC_COUNT(nodeCopies, 1);
+    auto node = makeCommitNode(arena, source->commitCounter, source->payload);
+    node->left = left;
+    node->right = right;
+    node->shape.height = 1 + std::max(getHeight(left, version), getHeight(right, version));
+    node->shape.size = 1 + getSize(left, version) + getSize(right, version);
+    node->shape.totals = getTotals(left, version) + source->payload->stats + getTotals(right, version);
+    return node;
+}
+
+
+// rotations that build new nodes instead of logging mods
+std::shared_ptr<CommitNode> rotateLeftJoined(NodeArena& arena, const std::shared_ptr<CommitNode>& x, int version) {
+    NodeView xv = resolveNode(x, version);
+    NodeView yv = resolveNode(xv.right, version);
+    return makeJoinedNode(arena, xv.right, makeJoinedNode(arena, x, xv.left, yv.left, version), yv.right, version);
+}
+
+
+std::shared_ptr<CommitNode> rotateRightJoined(NodeArena& arena, const std::shared_ptr<CommitNode>& y, int version) {
+    NodeView yv = resolveNode(y, version);
+    NodeView xv = resolveNode(yv.left, version);
+    return makeJoinedNode(arena, yv.left, xv.left, makeJoinedNode(arena, y, xv.right, yv.right, version), version);
+}
+
+
+// join down the right spine of the taller left tree
+std::shared_ptr<CommitNode> joinRight(NodeArena& arena, const std::shared_ptr<CommitNode>& left, const std::shared_ptr<CommitNode>& middle,
+    const std::shared_ptr<CommitNode>& right, int version) {
+    NodeView lv = resolveNode(left, version);
+    if (getHeight(lv.right, version) <= getHeight(right, version) + 1) {
+        auto joined = makeJoinedNode(arena, middle, lv.right, right, version);
+        if (getHeight(joined, version) <= getHeight(lv.left, version) + 1)
+            return makeJoinedNode(arena, left, lv.left, joined, version);
+        return rotateLeftJoined(arena, makeJoinedNode(arena, left, lv.left, rotateRightJoined(arena, joined, version), version), version);
+    }
+    auto joined = joinRight(arena, lv.right, middle, right, version);
+    auto top = makeJoinedNode(arena, left, lv.left, joined, version);
+    if (getHeight(joined, version) <= getHeight(lv.left, version) + 1)
+        return top;
+    return rotateLeftJoined(arena, top, version);
+}
+
+
+// join down the left spine of the taller right tree
+std::shared_ptr<CommitNode> joinLeft(NodeArena& arena, const std::shared_ptr<CommitNode>& left, const std::shared_ptr<CommitNode>& middle,
+    const std::shared_ptr<CommitNode>& right, int version) {
+    NodeView rv = resolveNode(right, version);
+    if (getHeight(rv.left, version) <= getHeight(left, version) + 1) {
+        auto joined = makeJoinedNode(arena, middle, left, rv.left, version);
+        if (getHeight(joined, version) <= getHeight(rv.right, version) + 1)
+            return makeJoinedNode(arena, right, joined, rv.right, version);
+        return rotateRightJoined(arena, makeJoinedNode(arena, right, rotateLeftJoined(arena, joined, version), rv.right, version), version);
+    }
+    auto joined = joinLeft(arena, left, middle, rv.left, version);
+    auto top = makeJoinedNode(arena, right, joined, rv.right, version);
+    if (getHeight(joined, version) <= getHeight(rv.right, version) + 1)
+        return top;
+    return rotateRightJoined(arena, top, version);
+}
+
+
+// balanced tree of left, the commit of middle and right, every commit in left < middle < every commit in right.
+// O(height difference)
+std::shared_ptr<CommitNode> joinTrees(NodeArena& arena, const std::shared_ptr<CommitNode>& left, const std::shared_ptr<CommitNode>& middle,
+    const std::shared_ptr<CommitNode>& right, int version) {
+    int lh = getHeight(left, version);
+    int rh = getHeight(right, version);
+    if (lh > rh + 1)
+        return joinRight(arena, left, middle, right, version);
+    if (rh > lh + 1)
+        return joinLeft(arena, left, middle, right, version);
+    return makeJoinedNode(arena, middle, left, right, version);
+}
+
+
+// takes the largest commit off root, returned in last, O(log n)
+std::shared_ptr<CommitNode> splitLast(NodeArena& arena, const std::shared_ptr<CommitNode>& root, std::shared_ptr<CommitNode>& last, int version) {
+    NodeView view = resolveNode(root, version);
+    if (!view.right) {
+        last = root;
+        return view.left;
+    }
+    auto rest = splitLast(arena, view.right, last, version);
+    return joinTrees(arena, view.left, root, rest, version);
+}
+
+
+// balanced tree of left and right, every commit in left < every commit in right. O(log n)
+std::shared_ptr<CommitNode> joinTrees(NodeArena& arena, const std::shared_ptr<CommitNode>& left, const std::shared_ptr<CommitNode>& right, int version) {
+    if (!left) return right;
+    if (!right) return left;
+    std::shared_ptr<CommitNode> last;
+    auto rest = splitLast(arena, left, last, version);
+    return joinTrees(arena, rest, last, right, version);
+}
+
+
+// splits root into commits below commitNumber (left) and the rest (right). O(log n)
+void splitTree(NodeArena& arena, const std::shared_ptr<CommitNode>& root, int commitNumber, int version,
+    std::shared_ptr<CommitNode>& left, std::shared_ptr<CommitNode>& right) {
+    if (!root) {
+        left = nullptr;
+        right = nullptr;
+        return;
+    }
+    NodeView view = resolveNode(root, version);
+    if (commitNumber <= root->commitCounter) {
+        std::shared_ptr<CommitNode> below;
+        splitTree(arena, view.left, commitNumber, version, left, below);
+        right = joinTrees(arena, below, root, view.right, version);
+    }
+    else {
+        std::shared_ptr<CommitNode> above;
+        splitTree(arena, view.right, commitNumber, version, above, right);
+        left = joinTrees(arena, view.left, root, above, version);
+    }
+}
+
+
+// Path copying insert for branches: every node on the path is rebuilt, nothing is logged,
+// so the tree it was called on stays exactly as it was. A commit already in the tree is replaced.
+std::shared_ptr<CommitNode> insertPathCopy(NodeArena& arena, const std::shared_ptr<CommitNode>& root, const std::shared_ptr<CommitNode>& fresh,
+    int version) {
+    if (!root)
+        return fresh;
+    NodeView view = resolveNode(root, version);
+    std::shared_ptr<CommitNode> node;
+    if (fresh->commitCounter == root->commitCounter)
+        return makeJoinedNode(arena, fresh, view.left, view.right, version);
+    if (fresh->commitCounter < root->commitCounter)
+        node = makeJoinedNode(arena, root, insertPathCopy(arena, view.left, fresh, version), view.right, version);
+    else
+        node = makeJoinedNode(arena, root, view.left, insertPathCopy(arena, view.right, fresh, version), version);
+
+    NodeView nv = resolveNode(node, version);
+    int balance = getHeight(nv.left, version) - getHeight(nv.right, version);
+    if (balance > 1) {
+        // left right case turns into left left first
+        if (getHeight(getLeft(nv.left, version), version) < getHeight(getRight(nv.left, version), version))
+            node = makeJoinedNode(arena, node, rotateLeftJoined(arena, nv.left, version), nv.right, version);
+        return rotateRightJoined(arena, node, version);
+    }
+    if (balance < -1) {
+        // right left case turns into right right first
+        if (getHeight(getRight(nv.right, version), version) < getHeight(getLeft(nv.right, version), version))
+            node = makeJoinedNode(arena, node, nv.left, rotateRightJoined(arena, nv.right, version), version);
+        return rotateLeftJoined(arena, node, version);
+    }
+    return node;
+}
+
+
+// Drops nodes without recursing through shared_ptr destructors. Old versions chain nodes
+// through their mod logs, so a recursive teardown of a long history overflows the stack
+void releaseNodes(std::vector<std::shared_ptr<CommitNode>>& pending) {
+    while (!pending.empty()) {
+        std::shared_ptr<CommitNode> node = std::move(pending.back());
+        pending.pop_back();
+        if (!node || node.use_count() != 1)
+            continue;
+        pending.push_back(std::move(node->left));
+        pending.push_back(std::move(node->right));
+        for (int i = 0; i < node->leftMods.count; i++)
+            pending.push_back(std::move(node->leftMods.values[i]));
+        for (int i = 0; i < node->rightMods.count; i++)
+            pending.push_back(std::move(node->rightMods.values[i]));
+    }
+}
+
+
+// builds a perfectly balanced subtree over sorted[first, last) bottom up, one node per commit
+std::shared_ptr<CommitNode> buildBalancedTree(NodeArena& arena, const std::vector<CommitInfo>& sorted, size_t first, size_t last) {
+    if (first >= last)
+        return nullptr;
+    size_t middle = first + (last - first) / 2;
+    const CommitInfo& commit = sorted[middle];
+    auto node = makeCommitNode(arena, commit.commitNumber,
+        makeCommitPayload(arena, commit.fileName, commit.diffData, commit.commitMessage, commit.stats,
+            commit.timestamp, commit.author));
+    node->left = buildBalancedTree(arena, sorted, first, middle);
+    node->right = buildBalancedTree(arena, sorted, middle + 1, last);
+    node->shape.totals = (node->left ? node->left->shape.totals : CommitStats()) + commit.stats
+        + (node->right ? node->right->shape.totals : CommitStats());
+    node->shape.height = 1 + std::max(node->left ? node->left->shape.height : 0, node->right ? node->right->shape.height : 0);
+    node->shape.size = (int)(last - first);
+    return node;
+}
+
+
+// balanced subtree of fresh nodes over sorted[first, last), reusing the commits' payloads
+std::shared_ptr<CommitNode> buildFromNodes(NodeArena& arena, const std::vector<const CommitNode*>& sorted, size_t first, size_t last) {
+    if (first >= last)
+        return nullptr;
+    size_t middle = first + (last - first) / 2;
+    auto node = makeCommitNode(arena, sorted[middle]->commitCounter, sorted[middle]->payload);
+    node->left = buildFromNodes(arena, sorted, first, middle);
+    node->right = buildFromNodes(arena, sorted, middle + 1, last);
+    node->shape.totals = (node->left ? node->left->shape.totals : CommitStats()) + node->payload->stats
+        + (node->right ? node->right->shape.totals : CommitStats());
+    node->shape.height = 1 + std::max(node->left ? node->left->shape.height : 0, node->right ? node->right->shape.height : 0);
+    node->shape.size = (int)(last - first);
+    return node;
+}
+
+
+// What one compaction pass gave back
+struct CompactionReport {
+    int versionsDropped;
+    size_t nodesFreed;      // nodes the history no longer reaches, a snapshot may still hold some of them
+    size_t bytesFreed;      // arena bytes, nodes and the payloads of commits no kept version has
+};
+
+
+// What a history holds right now, every node and payload reachable from some version or
+// branch revision counted once
+struct MemoryReport {
+    int versions;           // main line versions plus branch revisions
+    size_t nodes;
+    size_t nodeBytes;       // node structs, without the shared_ptr control blocks
+    size_t payloads;
+    size_t payloadBytes;
+    size_t modSlots[3 * CommitNode::MAX_MODS + 1];    // nodes by number of mod slots in use
+
+    size_t totalBytes() const { return nodeBytes + payloadBytes; }
+    double bytesPerVersion() const { return versions > 0 ? (double)totalBytes() / versions : 0.0; }
+
+    double modSlotsPerNode() const {
+        size_t used = 0;
+        for (int i = 0; i <= 3 * CommitNode::MAX_MODS; i++)
+            used += modSlots[i] * i;
+        return nodes > 0 ? (double)used / nodes : 0.0;
+    }
+};
+
+
+// In-order cursor over one version of the tree. Holding the root keeps the whole snapshot
+// alive, the path from the root down to the current commit lets next() and prev() move
+// in amortized O(1) instead of searching again from the root.
+class CommitCursor {
+public:
+    CommitCursor() : version(0) {}
+
+    // starts at the first commit of the snapshot
+    CommitCursor(std::shared_ptr<CommitNode> snapshotRoot, int snapshotVersion)
+        : root(std::move(snapshotRoot)), version(snapshotVersion) {
+        first();
+    }
+
+    bool valid() const { return !path.empty(); }
+    const CommitNode& node() const { return *path.back(); }
+    int commit() const { return path.back()->commitCounter; }
+    int snapshotVersion() const { return version; }
+
+    void first() {
+        path.clear();
+        for (const CommitNode* n = root.get(); n; n = leftOf(n))
+            path.push_back(n);
+    }
+
+    void last() {
+        path.clear();
+        for (const CommitNode* n = root.get(); n; n = rightOf(n))
+            path.push_back(n);
+    }
+
+    // moves to the first commit at or after target, true if target itself exists
+    bool seek(int target) {
+        path.clear();
+        size_t found = 0;
+        for (const CommitNode* n = root.get(); n; ) {
+            path.push_back(n);
+            if (target == n->commitCounter) {
+                return true;
+            }
+            if (target < n->commitCounter) {
+                found = path.size();
+                n = leftOf(n);
+            }
+            else {
+                n = rightOf(n);
+            }
+        }
+        path.resize(found);
+        return false;
+    }
+
+    // moves to the commit at position k (0 based), invalid if k is out of range
+    bool seekPosition(int k) {
+        path.clear();
+        for (const CommitNode* n = root.get(); n; ) {
+            path.push_back(n);
+            int leftSize = sizeOf(leftOf(n));
+            if (k < leftSize) {
+                n = leftOf(n);
+            }
+            else if (k == leftSize) {
+                return true;
+            }
+            else {
+                k -= leftSize + 1;
+                n = rightOf(n);
+            }
+        }
+        path.clear();
+        return false;
+    }
+
+    // false once it runs past the last commit, the cursor is then invalid
+    bool next() {
+        if (path.empty()) return false;
+        if (const CommitNode* n = rightOf(path.back())) {
+            for (; n; n = leftOf(n))
+                path.push_back(n);
+            return true;
+        }
+        // climb until we leave a left subtree
+        const CommitNode* child = path.back();
+        path.pop_back();
+        while (!path.empty() && child->commitCounter > path.back()->commitCounter) {
+            child = path.back();
+            path.pop_back();
+        }
+        return !path.empty();
+    }
+
+    // false once it runs past the first commit, the cursor is then invalid
+    bool prev() {
+        if (path.empty()) return false;
+        if (const CommitNode* n = leftOf(path.back())) {
+            for (; n; n = rightOf(n))
+                path.push_back(n);
+            return true;
+        }
+        // climb until we leave a right subtree
+        const CommitNode* child = path.back();
+        path.pop_back();
+        while (!path.empty() && child->commitCounter < path.back()->commitCounter) {
+            child = path.back();
+            path.pop_back();
+        }
+        return !path.empty();
+    }
+
+private:
+    const CommitNode* leftOf(const CommitNode* n) const { return n->leftMods.at(n->left, version).get(); }
+    const CommitNode* rightOf(const CommitNode* n) const { return n->rightMods.at(n->right, version).get(); }
+    int sizeOf(const CommitNode* n) const { return n ? n->shapeMods.at(n->shape, version).size : 0; }
+
+    std::shared_ptr<CommitNode> root;
+    int version;
+    std::vector<const CommitNode*> path;
+};
+
+
+// A named branch forked off one version of the history. Its commits are path copied, so
+// its own nodes never get mods and the nodes it shares with the main line are only ever
+// read at the fork version: every revision of the branch reads at baseVersion.
+// Forking costs one root, each commit on the branch one root to leaf path.
+class CommitBranch {
+public:
+    CommitBranch(NodeArena& historyArena, const std::shared_ptr<CommitNode>& forkRoot, int forkVersion)
+        : arena(&historyArena), heads(1, forkRoot), baseVersion(forkVersion) {}
+
+    // revisions count commits on the branch, revision 0 is the fork point
+    int latestRevision() const { return (int)heads.size() - 1; }
+    int forkVersion() const { return baseVersion; }
+
+    // head as of revision, revisions past the newest read the newest
+    const std::shared_ptr<CommitNode>& headAt(int revision) const {
+        if (revision < 0) return heads.front();
+        if (revision >= (int)heads.size()) return heads.back();
+        return heads[revision];
+    }
+
+    const std::shared_ptr<CommitNode>& head() const { return heads.back(); }
+
+    // adds a commit as a new revision and returns that revision
+    int insert(int commitCounter, const std::shared_ptr<const CommitPayload>& payload) {
+        heads.push_back(insertPathCopy(*arena, head(), makeCommitNode(*arena, commitCounter, payload), baseVersion));
+        MINIVC_COUNT(inserts, 1);
+        return latestRevision();
+    }
+
+    std::shared_ptr<CommitNode> search(int commit, int revision = INT_MAX) const {
+        return searchCommit(headAt(revision), commit, baseVersion);
+    }
+
+    std::shared_ptr<CommitNode> successor(int commit, int revision = INT_MAX) const {
+        return getSuccessor(headAt(revision), commit, baseVersion);
+    }
+
+    std::shared_ptr<CommitNode> predecessor(int commit, int revision = INT_MAX) const {
+        return getPredecessor(headAt(revision), commit, baseVersion);
+    }
+
+    int size(int revision = INT_MAX) const {
+        return getSize(headAt(revision), baseVersion);
+    }
+
+    CommitCursor cursor(int revision = INT_MAX) const {
+        return CommitCursor(headAt(revision), baseVersion);
+    }
+
+private:
+    friend class CommitHistory;
+
+    NodeArena* arena;       // the history's, the branch shares its nodes
+    std::vector<std::shared_ptr<CommitNode>> heads;
+    int baseVersion;
+};
+
+
+// Roots of every version of the tree, so any earlier snapshot is one index away.
+// Versions count changes to the tree and only ever grow, they are not commit numbers.
+// Version 0 is the empty tree. Nodes and payloads live in the history's own arena, every
+// snapshot or cursor taken from it has to be let go before the history is destroyed.
+class CommitHistory {
+public:
+    CommitHistory() : roots(1) {}
+
+    ~CommitHistory() {
+        clear();
+    }
+
+    CommitHistory(const CommitHistory&) = delete;
+    CommitHistory& operator=(const CommitHistory&) = delete;
+
+    int latestVersion() const { return (int)roots.size() - 1; }
+
+    // arena the history's nodes live in, payloads made for insert(commit, payload) go here too
+    NodeArena& nodeArena() { return arena; }
+    const NodeArena& nodeArena() const { return arena; }
+
+    // root as of version, versions past the newest read the newest
+    const std::shared_ptr<CommitNode>& rootAt(int version) const {
+        if (version < 0) return roots.front();
+        if (version >= (int)roots.size()) return roots.back();
+        return roots[version];
+    }
+
+    const std::shared_ptr<CommitNode>& latestRoot() const { return roots.back(); }
+
+    bool empty() const { return !latestRoot(); }
+
+    // adds a commit as a new version and returns that version.
+    // The payload's timestamp has to fit between its neighbours', see timeInOrder
+    int insert(int commitCounter, const std::shared_ptr<const CommitPayload>& payload) {
+        int version = latestVersion() + 1;
+        std::shared_ptr<CommitNode> root = insertNode(arena, latestRoot(), commitCounter, payload, version);
+        roots.push_back(root);
+        MINIVC_COUNT(inserts, 1);
+        return version;
+    }
+
+    int insert(int commitCounter, const std::wstring& fileName, const std::wstring& diffData,
+        const std::wstring& commitMessage = L"", const CommitStats& stats = CommitStats(),
+        long long timestamp = 0, const std::wstring& author = L"") {
+        return insert(commitCounter, makeCommitPayload(arena, fileName, diffData, commitMessage, stats,
+            timeInOrder(commitCounter, timestamp), author));
+    }
+
+    // timestamp moved between the ones of the commits around commit, a clock that went back
+    // records the time of the commit before instead
+    long long timeInOrder(int commit, long long timestamp) const {
+        std::shared_ptr<CommitNode> before = predecessor(commit, latestVersion());
+        std::shared_ptr<CommitNode> after = successor(commit, latestVersion());
+        if (before && timestamp < before->payload->timestamp)
+            timestamp = before->payload->timestamp;
+        if (after && timestamp > after->payload->timestamp)
+            timestamp = after->payload->timestamp;
+        return timestamp;
+    }
+
+    // replaces the tree with the given commits in one new version, linear after the sort.
+    // Used when loading a repository instead of inserting commit by commit
+    int bulkLoad(std::vector<CommitInfo> commits) {
+        std::sort(commits.begin(), commits.end(), [](const CommitInfo& a, const CommitInfo& b) {
+            return a.commitNumber < b.commitNumber;
+        });
+        commits.erase(std::unique(commits.begin(), commits.end(), [](const CommitInfo& a, const CommitInfo& b) {
+            return a.commitNumber == b.commitNumber;
+        }), commits.end());
+        for (size_t i = 1; i < commits.size(); i++) {
+            if (commits[i].timestamp < commits[i - 1].timestamp)
+                commits[i].timestamp = commits[i - 1].timestamp;
+        }
+        roots.push_back(buildBalancedTree(arena, commits, 0, commits.size()));
+        return latestVersion();
+    }
+
+    // new version without the commits after commit, the rollback. O(log n), older versions keep them
+    int truncateAfter(int commit) {
+        return keepRange(INT_MIN, commit);
+    }
+
+    // new version holding only the commits in [from, to]
+    int keepRange(int from, int to) {
+        int version = latestVersion() + 1;
+        std::shared_ptr<CommitNode> below, rest, kept, above;
+        splitTree(arena, latestRoot(), from, version, below, rest);
+        if (to < from)
+            kept = nullptr;
+        else if (to == INT_MAX)
+            kept = rest;
+        else
+            splitTree(arena, rest, to + 1, version, kept, above);
+        roots.push_back(kept);
+        return version;
+    }
+
+    // new version without the commits in [from, to], the two sides are joined back together
+    int removeRange(int from, int to) {
+        int version = latestVersion() + 1;
+        std::shared_ptr<CommitNode> below, rest, removed, above;
+        splitTree(arena, latestRoot(), from, version, below, rest);
+        if (to < from)
+            above = rest;
+        else if (to < INT_MAX)
+            splitTree(arena, rest, to + 1, version, removed, above);
+        roots.push_back(joinTrees(arena, below, above, version));
+        return version;
+    }
+
+    // commit as it existed at version, null if it did not exist yet
+    std::shared_ptr<CommitNode> search(int commit, int version) const {
+        return searchCommit(rootAt(version), commit, version);
+    }
+
+    std::shared_ptr<CommitNode> successor(int commit, int version) const {
+        return getSuccessor(rootAt(version), commit, version);
+    }
+
+    std::shared_ptr<CommitNode> predecessor(int commit, int version) const {
+        return getPredecessor(rootAt(version), commit, version);
+    }
+
+    // number of commits in the snapshot at version
+    int size(int version) const {
+        return getSize(rootAt(version), version);
+    }
+
+    // commit at position k in commit order, null if k is out of range
+    std::shared_ptr<CommitNode> select(int k, int version) const {
+        return selectCommit(rootAt(version), k, version);
+    }
+
+    // position commit has, or would have, in commit order
+    int rank(int commit, int version) const {
+        return rankCommit(rootAt(version), commit, version);
+    }
+
+    // number of commits in [from, to] as of version
+    int countInRange(int from, int to, int version) const {
+        if (to < from) return 0;
+        return rankCommit(rootAt(version), to, version, true) - rankCommit(rootAt(version), from, version);
+    }
+
+    // cursor over the snapshot at version, starting at its first commit
+    CommitCursor cursor(int version) const {
+        return CommitCursor(rootAt(version), version);
+    }
+
+    // every commit that existed at version, in commit order
+    std::vector<int> commitsAsOf(int version) const {
+        std::vector<int> commits;
+        for (CommitCursor c = cursor(version); c.valid(); c.next())
+            commits.push_back(c.commit());
+        return commits;
+    }
+
+    // calls visit(node) for every commit in [from, to] as of version, in commit order
+    template <class Visitor>
+    void forEachInRange(int from, int to, int version, Visitor visit) const {
+        CommitCursor c = cursor(version);
+        for (c.seek(from); c.valid() && c.commit() <= to; c.next())
+            visit(c.node());
+    }
+
+    // stats summed over the commits in [from, to] as of version
+    CommitStats churnInRange(int from, int to, int version) const {
+        if (to < from) return CommitStats();
+        return statsBelow(rootAt(version), to, version, true) - statsBelow(rootAt(version), from, version);
+    }
+
+    // newest commit recorded at or before time as of version, null if none: the file as it was then
+    std::shared_ptr<CommitNode> asOfTime(long long time, int version) const {
+        return latestAtTime(rootAt(version), time, version);
+    }
+
+    // position of the first commit recorded at or after time
+    int rankAtTime(long long time, int version) const {
+        return countBeforeTime(rootAt(version), time, version);
+    }
+
+    // number of commits recorded in [from, to] as of version
+    int countInTimeRange(long long from, long long to, int version) const {
+        if (to < from) return 0;
+        int upTo = to == LLONG_MAX ? size(version) : countBeforeTime(rootAt(version), to + 1, version);
+        return upTo - countBeforeTime(rootAt(version), from, version);
+    }
+
+    // calls visit(node) for every commit recorded in [from, to] as of version, O(log n + k)
+    template <class Visitor>
+    void forEachInTimeRange(long long from, long long to, int version, Visitor visit) const {
+        CommitCursor c = cursor(version);
+        for (c.seekPosition(rankAtTime(from, version)); c.valid() && c.node().payload->timestamp <= to; c.next())
+            visit(c.node());
+    }
+
+    // calls visit(node) for up to count commits starting at position first, one page of the timeline
+    template <class Visitor>
+    void forEachInPage(int first, int count, int version, Visitor visit) const {
+        CommitCursor c = cursor(version);
+        for (c.seekPosition(first); c.valid() && count > 0; c.next(), count--)
+            visit(c.node());
+    }
+
+    // Rebuilds the history so only the given versions (and the newest, always) stay readable,
+    // the others read as empty afterwards. Memory ends up proportional to the kept versions:
+    // nodes and mods that only dropped versions needed are freed. Kept versions are replayed
+    // oldest first onto fresh nodes, a small difference to the previous kept version as inserts
+    // and removals stamped with the kept version's number, anything else as a fresh balanced tree.
+    // Old nodes are never touched, snapshots and branches still holding them stay valid.
+    // Costs O(n) per kept version, plus a walk over every node before and after for the report.
+    CompactionReport compact(std::vector<int> keep) {
+        size_t nodesBefore = memoryReport().nodes;
+        size_t bytesBefore = arena.bytesInUse();
+
+        keep.push_back(latestVersion());
+        std::sort(keep.begin(), keep.end());
+        keep.erase(std::unique(keep.begin(), keep.end()), keep.end());
+
+        std::vector<std::shared_ptr<CommitNode>> rebuilt(roots.size());
+        std::vector<const CommitNode*> previous, commits;
+        std::shared_ptr<CommitNode> root;
+        int dropped = (int)roots.size();
+        for (int version : keep) {
+            if (version < 0 || version > latestVersion())
+                continue;
+            dropped--;
+            commits.clear();
+            for (CommitCursor c = cursor(version); c.valid(); c.next())
+                commits.push_back(&c.node());
+
+            // commits that are gone or new since the previous kept version, merged in commit order
+            std::vector<const CommitNode*> removed, added;
+            size_t i = 0, j = 0;
+            while (i < previous.size() || j < commits.size()) {
+                if (j == commits.size() || (i < previous.size() && previous[i]->commitCounter < commits[j]->commitCounter)) {
+                    removed.push_back(previous[i++]);
+                }
+                else if (i == previous.size() || commits[j]->commitCounter < previous[i]->commitCounter) {
+                    added.push_back(commits[j++]);
+                }
+                else {
+                    if (previous[i]->payload != commits[j]->payload) {
+                        removed.push_back(previous[i]);
+                        added.push_back(commits[j]);
+                    }
+                    i++;
+                    j++;
+                }
+            }
+
+            if ((removed.size() + added.size()) * 4 > commits.size()) {
+                root = buildFromNodes(arena, commits, 0, commits.size());
+            }
+            else {
+                for (const CommitNode* gone : removed) {
+                    std::shared_ptr<CommitNode> below, rest, single, above;
+                    splitTree(arena, root, gone->commitCounter, version, below, rest);
+                    if (gone->commitCounter < INT_MAX)
+                        splitTree(arena, rest, gone->commitCounter + 1, version, single, above);
+                    root = joinTrees(arena, below, above, version);
+                }
+                for (const CommitNode* fresh : added)
+                    root = insertNode(arena, root, fresh->commitCounter, fresh->payload, version);
+            }
+            rebuilt[version] = root;
+            previous.swap(commits);
+        }
+        previous.clear();
+        commits.clear();
+        root = nullptr;
+
+        roots.swap(rebuilt);
+        releaseNodes(rebuilt);
+
+        // keeping many close versions can take more nodes than it frees
+        size_t nodesAfter = memoryReport().nodes;
+        size_t bytesAfter = arena.bytesInUse();
+        CompactionReport report;
+        report.versionsDropped = dropped;
+        report.nodesFreed = nodesBefore > nodesAfter ? nodesBefore - nodesAfter : 0;
+        report.bytesFreed = bytesBefore > bytesAfter ? bytesBefore - bytesAfter : 0;
+        return report;
+    }
+
+    // forks a branch off version of the main line, false if the name is taken
+    bool createBranch(const std::wstring& name, int version) {
+        if (branches.count(name))
+            return false;
+        if (version < 0) version = 0;
+        if (version > latestVersion()) version = latestVersion();
+        branches.insert(std::make_pair(name, CommitBranch(arena, rootAt(version), version)));
+        return true;
+    }
+
+    // forks a branch off a revision of another branch
+    bool createBranch(const std::wstring& name, const std::wstring& from, int revision = INT_MAX) {
+        auto source = branches.find(from);
+        if (source == branches.end() || branches.count(name))
+            return false;
+        const CommitBranch& parent = source->second;
+        branches.insert(std::make_pair(name, CommitBranch(arena, parent.headAt(revision), parent.forkVersion())));
+        return true;
+    }
+
+    // null if there is no branch of that name
+    CommitBranch* branch(const std::wstring& name) {
+        auto found = branches.find(name);
+        return found == branches.end() ? nullptr : &found->second;
+    }
+
+    const CommitBranch* branch(const std::wstring& name) const {
+        auto found = branches.find(name);
+        return found == branches.end() ? nullptr : &found->second;
+    }
+
+    std::vector<std::wstring> branchNames() const {
+        std::vector<std::wstring> names;
+        for (const auto& entry : branches)
+            names.push_back(entry.first);
+        return names;
+    }
+
+    bool deleteBranch(const std::wstring& name) {
+        auto found = branches.find(name);
+        if (found == branches.end())
+            return false;
+        releaseNodes(found->second.heads);
+        branches.erase(found);
+        return true;
+    }
+
+    // walks every version and branch once, O(nodes) with a hash set per node and payload
+    MemoryReport memoryReport() const {
+        MemoryReport report = MemoryReport();
+        report.versions = latestVersion();
+        std::vector<const CommitNode*> pending;
+        auto follow = [&pending](const std::shared_ptr<CommitNode>& node) {
+            if (node) pending.push_back(node.get());
+        };
+        for (const auto& root : roots)
+            follow(root);
+        for (const auto& entry : branches) {
+            report.versions += entry.second.latestRevision();
+            for (const auto& head : entry.second.heads)
+                follow(head);
+        }
+
+        std::unordered_set<const CommitNode*> seen;
+        std::unordered_set<const CommitPayload*> payloads;
+        while (!pending.empty()) {
+            const CommitNode* node = pending.back();
+            pending.pop_back();
+            if (!seen.insert(node).second)
+                continue;
+            int lefts = node->leftMods.count.load(std::memory_order_acquire);
+            int rights = node->rightMods.count.load(std::memory_order_acquire);
+            int shapes = node->shapeMods.count.load(std::memory_order_acquire);
+            report.modSlots[lefts + rights + shapes]++;
+            follow(node->left);
+            follow(node->right);
+            for (int i = 0; i < lefts; i++)
+                follow(node->leftMods.values[i]);
+            for (int i = 0; i < rights; i++)
+                follow(node->rightMods.values[i]);
+            if (payloads.insert(node->payload.get()).second)
+                report.payloadBytes += node->payload->footprint();
+        }
+        report.nodes = seen.size();
+        report.nodeBytes = seen.size() * sizeof(CommitNode);
+        report.payloads = payloads.size();
+        return report;
+    }
+
+    // drops every version and branch. The arena's slabs go back too unless a snapshot still holds nodes
+    void clear() {
+        for (auto& entry : branches)
+            releaseNodes(entry.second.heads);
+        branches.clear();
+        releaseNodes(roots);
+        roots.assign(1, nullptr);
+        arena.release();
+    }
+
+private:
+    NodeArena arena;        // first, so it outlives every node below
+    std::vector<std::shared_ptr<CommitNode>> roots;
+    std::map<std::wstring, CommitBranch> branches;
+};
@@ -0,0 +1,124 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+
+// 256-bit BLAKE2b (RFC 7693) of a document's text, the key of the blob it is stored as.
+// Cryptographic strength, so two different texts never share a blob in practice, and about
+// as fast as reading the text from disk. Self-contained, no library to link.
+struct ContentHash {
+    uint8_t bytes[32];
+
+    // lower-case hex, the blob's file name
+    std::wstring hex() const {
+        static const wchar_t digits[] = L"0123456789abcdef";
+        std::wstring out(64, L'0');
+        for (int i = 0; i < 32; i++) {
+            out[2 * i] = digits[bytes[i] >> 4];
+            out[2 * i + 1] = digits[bytes[i] & 15];
+        }
+        return out;
+    }
+};
+
+
+const uint64_t BLAKE2B_IV[8] = {
+    0x6A09E667F3BCC908ULL, 0xBB67AE8584CAA73BULL, 0x3C6EF372FE94F82BULL, 0xA54FF53A5F1D36F1ULL,
+    0x510E527FADE682D1ULL, 0x9B05688C2B3E6C1FULL, 0x1F83D9ABFB41BD6BULL, 0x5BE0CD19137E2179ULL
+};
+
+const uint8_t BLAKE2B_SIGMA[12][16] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+    { 11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4 },
+    { 7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8 },
+    { 9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13 },
+    { 2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9 },
+    { 12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11 },
+    { 13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10 },
+    { 6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5 },
+    { 10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0 },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 }
+};
+
+
+uint64_t rotateRight64(uint64_t x, int n) {
+    return (x >> n) | (x << (64 - n));
+}
+
+// the G function on four words of the state
+void blake2bMix(uint64_t v[16], int a, int b, int c, int d, uint64_t x, uint64_t y) {
+    v[a] = v[a] + v[b] + x;
+    v[d] = rotateRight64(v[d] ^ v[a], 32);
+    v[c] = v[c] + v[d];
+    v[b] = rotateRight64(v[b] ^ v[c], 24);
+    v[a] = v[a] + v[b] + y;
+    v[d] = rotateRight64(v[d] ^ v[a], 16);
+    v[c] = v[c] + v[d];
+    v[b] = rotateRight64(v[b] ^ v[c], 63);
+}
+
+// mixes one 128-byte block into the state, last marks the final block
+void blake2bCompress(uint64_t h[8], const uint8_t* block, uint64_t counter, bool last) {
+    uint64_t m[16], v[16];
+    for (int i = 0; i < 16; i++) {
+        // little-endian words whatever the host
+        uint64_t word = 0;
+        for (int b = 7; b >= 0; b--)
+            word = (word << 8) | block[i * 8 + b];
+        m[i] = word;
+    }
+    for (int i = 0; i < 8; i++) {
+        v[i] = h[i];
+        v[i + 8] = BLAKE2B_IV[i];
+    }
+    v[12] ^= counter;
+    if (last)
+        v[14] = ~v[14];
+
+    // columns, then diagonals
+    for (int round = 0; round < 12; round++) {
+        const uint8_t* s = BLAKE2B_SIGMA[round];
+        blake2bMix(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+        blake2bMix(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+        blake2bMix(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+        blake2bMix(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+        blake2bMix(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+        blake2bMix(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+        blake2bMix(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+        blake2bMix(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+    for (int i = 0; i < 8; i++)
+        h[i] ^= v[i] ^ v[i + 8];
+}
+
+ContentHash hashContent(const void* data, size_t size) {
+    uint64_t h[8];
+    for (int i = 0; i < 8; i++)
+        h[i] = BLAKE2B_IV[i];
+    h[0] ^= 0x01010000ULL ^ 32;     // no key, 32-byte digest
+
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint64_t counter = 0;
+    while (size > 128) {
+        counter += 128;
+        blake2bCompress(h, p, counter, false);
+        p += 128;
+        size -= 128;
+    }
+    uint8_t last[128] = { 0 };
+    if (size > 0)
+        memcpy(last, p, size);
+    blake2bCompress(h, last, counter + size, true);
+
+    ContentHash out;
+    for (int i = 0; i < 32; i++)
+        out.bytes[i] = (uint8_t)(h[i / 8] >> (8 * (i % 8)));
+    return out;
+}
+
+ContentHash hashContent(const std::string& text) {
+    return hashContent(text.data(), text.size());
+}
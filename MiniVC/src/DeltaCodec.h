@@ -0,0 +1,201 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+// Copy/insert deltas between two versions of a document. The object pack stores a new text as
+// a delta from the previous commit's text (ObjectPack.h), so a commit that changes a few lines
+// of a large file costs a few hundred bytes on disk instead of another copy of the file.
+//
+// Layout: "MVD1", then the target length and a reserved varint, written as 0 and not read,
+// then ops to the end. The pack record names the base, the delta does not:
+//   0 offset length    copy length bytes of the base from offset
+//   1 length bytes     insert the bytes that follow
+// Varints are little-endian base 128, 7 bits per byte and the high bit set on all but the last.
+
+const char DELTA_MAGIC[4] = { 'M', 'V', 'D', '1' };
+const size_t DELTA_BLOCK = 16;          // bytes hashed per block of the base
+const size_t DELTA_WINDOW = 64;         // target bytes searched for the longest match
+const size_t DELTA_GOOD_MATCH = 256;    // a match this long is taken without looking further
+
+
+void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+bool getVarint(const std::string& in, size_t& pos, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; pos < in.size() && shift < 64; shift += 7) {
+        unsigned char byte = (unsigned char)in[pos++];
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+
+// hash of the DELTA_BLOCK bytes at p
+uint32_t hashDeltaBlock(const char* p) {
+    uint64_t a, b;
+    memcpy(&a, p, 8);
+    memcpy(&b, p + 8, 8);
+    uint64_t h = a * 0x9E3779B97F4A7C15ULL ^ b * 0xC2B2AE3D27D4EB4FULL;
+    return (uint32_t)(h >> 32) ^ (uint32_t)h;
+}
+
+
+// Delta that rebuilds target from base. The common prefix and suffix become one copy each,
+// the middle is matched against 16-byte blocks of the base, so edits in several places and
+// moved lines still become copies. Roughly linear in the sizes of both, DELTA_WINDOW times
+// the match length at worst on text that repeats itself in short runs
+std::string encodeDelta(const std::string& base, const std::string& target) {
+    std::string out(DELTA_MAGIC, sizeof(DELTA_MAGIC));
+    putVarint(out, target.size());
+    putVarint(out, 0);
+
+    auto copy = [&out](size_t offset, size_t length) {
+        out.push_back(0);
+        putVarint(out, offset);
+        putVarint(out, length);
+    };
+    auto insert = [&out, &target](size_t from, size_t to) {
+        if (from == to)
+            return;
+        out.push_back(1);
+        putVarint(out, to - from);
+        out.append(target, from, to - from);
+    };
+
+    size_t shorter = base.size() < target.size() ? base.size() : target.size();
+    size_t prefix = 0;
+    while (prefix < shorter && base[prefix] == target[prefix])
+        prefix++;
+    size_t suffix = 0;
+    while (suffix < shorter - prefix && base[base.size() - 1 - suffix] == target[target.size() - 1 - suffix])
+        suffix++;
+    size_t baseEnd = base.size() - suffix;
+    size_t targetEnd = target.size() - suffix;
+    if (prefix > 0)
+        copy(0, prefix);
+
+    // block start + 1 by hash, 0 for an empty slot. The first block with a hash keeps the
+    // slot, on repeated text it is the one with the longest run ahead of it
+    size_t blocks = (baseEnd - prefix) / DELTA_BLOCK;
+    size_t slots = 1024;
+    while (slots < blocks * 2)
+        slots *= 2;
+    std::vector<uint32_t> table(blocks > 0 ? slots : 0, 0);
+    for (size_t i = 0; i < blocks; i++) {
+        size_t at = prefix + i * DELTA_BLOCK;
+        uint32_t& slot = table[hashDeltaBlock(&base[at]) & (slots - 1)];
+        if (slot == 0)
+            slot = (uint32_t)(at + 1);
+    }
+
+    // From t on, the longest match within the next DELTA_WINDOW bytes wins. A candidate is the
+    // base block of the same hash or the spot right after the last copy, the second keeps a
+    // long run going where lines repeat and the hashed block belongs to some other line
+    auto extend = [&](size_t from, size_t at) {
+        size_t length = 0;
+        while (from + length < baseEnd && at + length < targetEnd && base[from + length] == target[at + length])
+            length++;
+        return length;
+    };
+    size_t literal = prefix;
+    size_t t = prefix;
+    size_t lastEnd = prefix;    // base position after the last copy, lined up with literal
+    while (blocks > 0 && t + DELTA_BLOCK <= targetEnd) {
+        size_t bestAt = 0, bestFrom = 0, bestLength = 0;
+        size_t at = t;
+        for (; at < t + DELTA_WINDOW && at + DELTA_BLOCK <= targetEnd && bestLength < DELTA_GOOD_MATCH; at++) {
+            size_t following = lastEnd + (at - literal);
+            if (following < baseEnd) {
+                size_t length = extend(following, at);
+                if (length > bestLength && length >= DELTA_BLOCK) {
+                    bestAt = at;
+                    bestFrom = following;
+                    bestLength = length;
+                }
+            }
+            uint32_t slot = table[hashDeltaBlock(&target[at]) & (slots - 1)];
+            if (slot != 0 && slot - 1 != following && memcmp(&base[slot - 1], &target[at], DELTA_BLOCK) == 0) {
+                size_t length = extend(slot - 1, at);
+                if (length > bestLength) {
+                    bestAt = at;
+                    bestFrom = slot - 1;
+                    bestLength = length;
+                }
+            }
+        }
+        if (bestLength == 0) {
+            t = at;
+            continue;
+        }
+        // the match may also reach back into the pending literal
+        while (bestFrom > prefix && bestAt > literal && base[bestFrom - 1] == target[bestAt - 1]) {
+            bestFrom--;
+            bestAt--;
+            bestLength++;
+        }
+        insert(literal, bestAt);
+        copy(bestFrom, bestLength);
+        t = bestAt + bestLength;
+        literal = t;
+        lastEnd = bestFrom + bestLength;
+    }
+    insert(literal, targetEnd);
+    if (suffix > 0)
+        copy(baseEnd, suffix);
+    return out;
+}
+
+
+// target length from the front of a delta and pos past the header, false if it is not one
+bool readDeltaHeader(const std::string& delta, uint64_t& targetLength, size_t& pos) {
+    if (delta.size() < sizeof(DELTA_MAGIC) || memcmp(delta.data(), DELTA_MAGIC, sizeof(DELTA_MAGIC)) != 0)
+        return false;
+    pos = sizeof(DELTA_MAGIC);
+    uint64_t reserved;
+    return getVarint(delta, pos, targetLength) && getVarint(delta, pos, reserved);
+}
+
+
+// rebuilds the target of delta from base, false if the delta is damaged or made for another base
+bool applyDelta(const std::string& base, const std::string& delta, std::string& target) {
+    uint64_t targetLength;
+    size_t pos;
+    if (!readDeltaHeader(delta, targetLength, pos))
+        return false;
+
+    // a damaged length must not turn into a huge allocation
+    target.clear();
+    if (targetLength <= 2 * (uint64_t)base.size() + delta.size())
+        target.reserve((size_t)targetLength);
+    while (pos < delta.size()) {
+        char op = delta[pos++];
+        uint64_t offset = 0, length;
+        if (op == 0 && !getVarint(delta, pos, offset))
+            return false;
+        if ((op != 0 && op != 1) || !getVarint(delta, pos, length))
+            return false;
+        if (op == 0) {
+            if (offset > base.size() || length > base.size() - offset)
+                return false;
+            target.append(base, (size_t)offset, (size_t)length);
+        }
+        else {
+            if (length > delta.size() - pos)
+                return false;
+            target.append(delta, pos, (size_t)length);
+            pos += (size_t)length;
+        }
+    }
+    return target.size() == targetLength;
+}
@@ -30,6 +30,9 @@
 
 #define IDD_FILE_LIST_DLG 101
 #define IDC_FILE_LIST     1001
+#define IDC_TIME_FROM     1007
+#define IDC_TIME_TO       1008
+#define IDC_TIME_FILTER   1009
 
 
 #define IDD_VIEW_ONLY_DLG  102
@@ -0,0 +1,266 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+// File access for everything the plugin keeps on disk, on Windows and, for the benchmark and
+// tests, on POSIX systems:
+//   MappedFile   a whole file mapped read only and read in place, nothing copied on open
+//   readFile     a whole file in one allocation and one read, sized from the file's length
+//   FileWriter   writes gathered into large blocks, so the file sees a few big writes
+
+
+#ifndef _WIN32
+// path in the locale's multibyte encoding, POSIX calls take no wide paths
+bool narrowPath(const std::wstring& path, std::string& narrow) {
+    narrow.assign(path.size() * 4 + 1, '\0');
+    size_t n = wcstombs(&narrow[0], path.c_str(), narrow.size());
+    if (n == (size_t)-1)
+        return false;
+    narrow.resize(n);
+    return true;
+}
+#endif
+
+
+// fopen for wide paths on both platforms
+FILE* openFile(const std::wstring& path, const wchar_t* mode) {
+#ifdef _WIN32
+    return _wfopen(path.c_str(), mode);
+#else
+    std::string narrow;
+    if (!narrowPath(path, narrow))
+        return nullptr;
+    std::string narrowMode;
+    for (const wchar_t* m = mode; *m; m++)
+        narrowMode.push_back((char)*m);
+    return fopen(narrow.c_str(), narrowMode.c_str());
+#endif
+}
+
+
+// replaces to with from, files are written aside first so a crash never leaves half a file
+bool replaceFile(const std::wstring& from, const std::wstring& to) {
+#ifdef _WIN32
+    return MoveFileExW(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    std::string a, b;
+    return narrowPath(from, a) && narrowPath(to, b) && rename(a.c_str(), b.c_str()) == 0;
+#endif
+}
+
+
+// 64-bit seek, files outgrow a long on Windows
+bool seekFile(FILE* fp, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(fp, (long long)offset, SEEK_SET) == 0;
+#else
+    return fseeko(fp, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+uint64_t fileLength(FILE* fp) {
+#ifdef _WIN32
+    if (_fseeki64(fp, 0, SEEK_END) != 0)
+        return 0;
+    long long size = _ftelli64(fp);
+#else
+    if (fseeko(fp, 0, SEEK_END) != 0)
+        return 0;
+    long long size = (long long)ftello(fp);
+#endif
+    return size < 0 ? 0 : (uint64_t)size;
+}
+
+// cuts the file to size bytes, nothing of it may be mapped on Windows
+bool truncateFile(FILE* fp, uint64_t size) {
+    if (fflush(fp) != 0)
+        return false;
+#ifdef _WIN32
+    return _chsize_s(_fileno(fp), (long long)size) == 0;
+#else
+    return ftruncate(fileno(fp), (off_t)size) == 0;
+#endif
+}
+
+
+// Reads the whole file into contents: its length first, then one allocation and one read
+// straight into it, no stream or bounce buffer in between. False if it can't be opened, an
+// empty file reads as an empty string
+bool readFile(const std::wstring& path, std::string& contents) {
+    FILE* fp = openFile(path, L"rb");
+    if (!fp)
+        return false;
+    setvbuf(fp, nullptr, _IONBF, 0);
+    uint64_t length = fileLength(fp);
+    bool ok = length <= (uint64_t)(size_t)-1 && seekFile(fp, 0);
+    if (ok) {
+        contents.resize((size_t)length);
+        // a file that shrank in the meantime reads as what is left of it
+        contents.resize(length > 0 ? fread(&contents[0], 1, contents.size(), fp) : 0);
+    }
+    fclose(fp);
+    return ok;
+}
+
+
+// bytes read in place, in a mapping or in a buffer that outlives the span
+struct FileSpan {
+    const char* data;
+    size_t size;
+};
+
+
+// A whole file mapped read only. Pages come in as they are read, nothing is copied, so a
+// large object is decoded straight out of the page cache. Opens alongside a writer; a file
+// being appended to is mapped up to its length at the time, open it again to see more.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    // false if the file is missing or can't be mapped, an empty file opens with no bytes
+    bool open(const std::wstring& path) {
+        close();
+#ifdef _WIN32
+        file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || (uint64_t)size.QuadPart > (uint64_t)(size_t)-1) {
+            close();
+            return false;
+        }
+        opened = true;
+        if (size.QuadPart == 0)
+            return true;
+        mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        base = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (!base) {
+            close();
+            return false;
+        }
+        bytes = (size_t)size.QuadPart;
+        return true;
+#else
+        std::string narrow;
+        if (!narrowPath(path, narrow))
+            return false;
+        int fd = ::open(narrow.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (uint64_t)st.st_size > (uint64_t)(size_t)-1) {
+            ::close(fd);
+            return false;
+        }
+        void* p = st.st_size > 0 ? mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0) : nullptr;
+        ::close(fd);
+        if (p == MAP_FAILED)
+            return false;
+        opened = true;
+        base = p;
+        bytes = (size_t)st.st_size;
+        return true;
+#endif
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (base) UnmapViewOfFile(base);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+        mapping = NULL;
+#else
+        if (base) munmap(base, bytes);
+#endif
+        base = nullptr;
+        bytes = 0;
+        opened = false;
+    }
+
+    bool isOpen() const { return opened; }
+    const char* data() const { return static_cast<const char*>(base); }
+    size_t size() const { return bytes; }
+
+    // true if [offset, offset + length) lies inside the mapping
+    bool covers(uint64_t offset, uint64_t length) const {
+        return offset <= bytes && length <= bytes - offset;
+    }
+
+private:
+    void* base = nullptr;
+    size_t bytes = 0;
+    bool opened = false;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#endif
+};
+
+
+const size_t FILE_WRITE_BLOCK = (size_t)1 << 20;
+
+// Gathers writes into FILE_WRITE_BLOCK bytes before handing them to the file, a write at least
+// that large goes straight through after what is gathered. finish writes the rest and tells
+// whether every write went through; the caller still closes the file
+class FileWriter {
+public:
+    explicit FileWriter(FILE* file) : fp(file) {
+        setvbuf(fp, nullptr, _IONBF, 0);
+        buffer.reserve(FILE_WRITE_BLOCK);
+    }
+
+    void write(const void* data, size_t size) {
+        written += size;
+        if (buffer.size() + size > FILE_WRITE_BLOCK)
+            flush();
+        if (size >= FILE_WRITE_BLOCK)
+            ok = ok && fwrite(data, 1, size, fp) == size;
+        else
+            buffer.append(static_cast<const char*>(data), size);
+    }
+
+    // zeros up to the next multiple of alignment, at most 8
+    void padTo(size_t alignment) {
+        static const char zeros[8] = {};
+        size_t padding = (size_t)((alignment - written % alignment) % alignment);
+        if (padding)
+            write(zeros, padding);
+    }
+
+    uint64_t bytes() const { return written; }
+
+    bool finish() {
+        flush();
+        return ok && fflush(fp) == 0;
+    }
+
+private:
+    void flush() {
+        if (!buffer.empty())
+            ok = ok && fwrite(buffer.data(), 1, buffer.size(), fp) == buffer.size();
+        buffer.clear();
+    }
+
+    FILE* fp;
+    std::string buffer;
+    uint64_t written = 0;
+    bool ok = true;
+};
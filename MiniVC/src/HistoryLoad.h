@@ -0,0 +1,72 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+#include "CommitImage.h"
+#include "CommitRepository.h"
+#include "ObjectPack.h"
+
+
+// Loading a history from its folder, shared by the plugin and the benchmark so the check
+// replays a pack exactly the way the plugin does. The newest version of the image comes in
+// first and the pack records after what objects.idx covered are replayed on top; without an
+// image, or with a damaged one, every record in the pack is the history.
+
+
+// Replays commits and truncates on top of the repository's newest version. Replaying is
+// idempotent, a crash between writing the image and the pack index only repeats work.
+void replayDeltas(CommitRepository& repository, const std::vector<DeltaRecord>& records) {
+    for (const DeltaRecord& record : records) {
+        const CommitHistory& history = repository.history();
+        if (record.type == DELTA_TRUNCATE) {
+            repository.truncateAfter(record.commit.commitNumber);
+        }
+        else if (!history.search(record.commit.commitNumber, history.latestVersion())) {
+            const CommitInfo& c = record.commit;
+            repository.insert(c.commitNumber, c.fileName, c.diffData, c.commitMessage, c.stats, c.timestamp, c.author);
+        }
+    }
+}
+
+
+// Copies the newest version out of the mapped image at path into the repository and replays
+// the records the image does not hold yet, replayed says how many. The image is validated and
+// copied rather than queried in place, a mapping the next fold replaces can't back the tree.
+// False if there is no image or it is damaged, the repository is left as it was then
+bool loadCommitImage(CommitRepository& repository, ObjectPack& pack, const std::wstring& path, size_t& replayed) {
+    std::vector<CommitInfo> commits;
+    {
+        CommitImage image;
+        if (!image.open(path))
+            return false;
+        int latest = image.latestVersion();
+        commits.reserve(image.size(latest));
+        if (!image.forEach(latest, [&](CommitImage::NodeIndex node) { commits.push_back(image.infoOf(node)); }))
+            return false;
+    }
+    repository.bulkLoad(std::move(commits));
+
+    std::vector<DeltaRecord> packed = pack.records(pack.indexedBytes());
+    replayDeltas(repository, packed);
+    replayed = packed.size();
+    return true;
+}
+
+
+// Loads every record in the pack, each commit as last recorded, over the commits in live,
+// which a folder from before the pack reads from its commit files.
+void loadPackRecords(CommitRepository& repository, ObjectPack& pack, std::map<int, CommitInfo> live) {
+    for (DeltaRecord& record : pack.records(0)) {
+        if (record.type == DELTA_TRUNCATE)
+            live.erase(live.upper_bound(record.commit.commitNumber), live.end());
+        else
+            live[record.commit.commitNumber] = std::move(record.commit);
+    }
+    std::vector<CommitInfo> commits;
+    commits.reserve(live.size());
+    for (auto& entry : live)
+        commits.push_back(std::move(entry.second));
+
+    // The bulk loader builds the balanced tree in one pass.
+    repository.bulkLoad(std::move(commits));
+}
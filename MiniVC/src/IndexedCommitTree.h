@@ -0,0 +1,326 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "CommitTree.h"
+
+
+// Pointer-free variant of the partially persistent AVL tree in CommitTree.h.
+// Nodes live in contiguous structure-of-arrays pools and link to each other through
+// 32-bit indices, so a traversal step touches a few small arrays instead of chasing
+// shared_ptrs, and copies never touch reference counts. Same fat node scheme:
+// every node carries MAX_MODS version-stamped modifications and is copied once full.
+// Versions count changes the way CommitHistory's do: version 0 is the empty tree and every
+// insert or truncate makes the next one, whatever the commit number.
+class IndexedCommitTree {
+public:
+    typedef uint32_t NodeIndex;
+    static const NodeIndex NIL = 0xFFFFFFFFu;
+    static const int MAX_MODS = 5;
+
+    // a copy of NIL, the vector takes it by reference and NIL has no out-of-class definition
+    IndexedCommitTree() : versionRoots(1, NodeIndex(NIL)) {}
+
+    NodeIndex root() const { return versionRoots.back(); }
+    int latestVersion() const { return (int)versionRoots.size() - 1; }
+
+    // root as of version, versions past the newest read the newest
+    NodeIndex rootAt(int version) const {
+        if (version < 0) return NIL;
+        if (version >= (int)versionRoots.size()) return versionRoots.back();
+        return versionRoots[version];
+    }
+    size_t nodeCount() const { return keys.size(); }
+
+    int commitOf(NodeIndex node) const { return keys[node]; }
+    const CommitInfo& infoOf(NodeIndex node) const { return commits[payloads[node]]; }
+
+    void reserve(size_t nodes) {
+        keys.reserve(nodes);
+        lefts.reserve(nodes);
+        rights.reserve(nodes);
+        heights.reserve(nodes);
+        payloads.reserve(nodes);
+        modCounts.reserve(nodes);
+        modVersions.reserve(nodes * MAX_MODS);
+        modFields.reserve(nodes * MAX_MODS);
+        modValues.reserve(nodes * MAX_MODS);
+    }
+
+    void clear() {
+        *this = IndexedCommitTree();
+    }
+
+    // Bytes held by the node pools, payload strings excluded
+    size_t bytesUsed() const {
+        return keys.capacity() * sizeof(int) + lefts.capacity() * sizeof(NodeIndex)
+            + rights.capacity() * sizeof(NodeIndex) + heights.capacity() * sizeof(uint8_t)
+            + payloads.capacity() * sizeof(uint32_t) + modCounts.capacity() * sizeof(uint8_t)
+            + modVersions.capacity() * sizeof(int) + modFields.capacity() * sizeof(uint8_t)
+            + modValues.capacity() * sizeof(uint32_t) + commits.capacity() * sizeof(CommitInfo)
+            + versionRoots.capacity() * sizeof(NodeIndex);
+    }
+
+    // Return left child of node as of version
+    NodeIndex getLeft(NodeIndex node, int version) const {
+        return readField(node, LEFT, lefts[node], version);
+    }
+
+    // Return right child of node as of version
+    NodeIndex getRight(NodeIndex node, int version) const {
+        return readField(node, RIGHT, rights[node], version);
+    }
+
+    // Return height of node as of version, 0 for NIL
+    int getHeight(NodeIndex node, int version) const {
+        if (node == NIL) return 0;
+        return (int)readField(node, HEIGHT, heights[node], version);
+    }
+
+    // Adding a new commit as the next version, returns that version
+    int insertNode(int commitCounter, const std::wstring& fileName, const std::wstring& diffData,
+        const std::wstring& commitMessage = L"") {
+        int version = latestVersion() + 1;
+        NodeIndex rootIndex = root();
+        commits.push_back({ commitCounter, fileName, diffData, commitMessage, CommitStats(), 0, L"" });
+        NodeIndex fresh = newNode(commitCounter, (uint32_t)(commits.size() - 1), NIL, NIL, 1);
+        if (rootIndex == NIL) {
+            versionRoots.push_back(fresh);
+            return version;
+        }
+
+        // Walk down once and remember the path, no recursion
+        path.clear();
+        NodeIndex current = rootIndex;
+        while (current != NIL) {
+            bool goLeft = commitCounter < keys[current];
+            path.push_back(PathStep{ current, goLeft });
+            current = goLeft ? getLeft(current, version) : getRight(current, version);
+        }
+
+        // Walk back up re-linking children, fixing heights and rotating where needed.
+        // Stops as soon as a subtree keeps both its root and its height.
+        NodeIndex child = fresh;
+        size_t depth = path.size();
+        while (depth > 0) {
+            depth--;
+            NodeIndex original = path[depth].node;
+            int oldHeight = getHeight(original, version);
+            NodeIndex node = original;
+            if (path[depth].wentLeft) {
+                if (getLeft(node, version) != child)
+                    node = updateField(node, LEFT, child, version);
+            }
+            else {
+                if (getRight(node, version) != child)
+                    node = updateField(node, RIGHT, child, version);
+            }
+            node = refreshHeight(node, version);
+            node = rebalance(node, version);
+            child = node;
+            if (node == original && getHeight(node, version) == oldHeight) {
+                versionRoots.push_back(rootIndex);
+                return version;
+            }
+        }
+        versionRoots.push_back(child);
+        return version;
+    }
+
+    // New version holding only the commits up to commit, what a rollback leaves. The kept
+    // commits go into fresh balanced nodes sharing their payloads, older versions keep their
+    // nodes. Costs O(kept commits), rollbacks are rare next to inserts
+    int truncateAfter(int commit) {
+        int version = latestVersion() + 1;
+        std::vector<NodeIndex> kept;
+        std::vector<NodeIndex> stack;
+        for (NodeIndex current = root(); current != NIL || !stack.empty(); ) {
+            if (current != NIL) {
+                stack.push_back(current);
+                current = getLeft(current, version);
+                continue;
+            }
+            current = stack.back();
+            stack.pop_back();
+            if (keys[current] > commit)
+                break;
+            kept.push_back(current);
+            current = getRight(current, version);
+        }
+        versionRoots.push_back(buildBalanced(kept, 0, kept.size(), version));
+        return version;
+    }
+
+    // Returns the node holding targetCommit as of version, NIL if it is not in the tree
+    NodeIndex searchCommit(int targetCommit, int version) const {
+        NodeIndex current = rootAt(version);
+        while (current != NIL) {
+            int key = keys[current];
+            if (targetCommit == key)
+                return current;
+            current = targetCommit < key ? getLeft(current, version) : getRight(current, version);
+        }
+        return NIL;
+    }
+
+    // Returns the first commit after commitNumber, NIL if none
+    NodeIndex getSuccessor(int commitNumber, int version) const {
+        NodeIndex successor = NIL;
+        NodeIndex current = rootAt(version);
+        while (current != NIL) {
+            if (commitNumber < keys[current]) {
+                successor = current;
+                current = getLeft(current, version);
+            }
+            else {
+                current = getRight(current, version);
+            }
+        }
+        return successor;
+    }
+
+    // Returns the last commit before commitNumber, NIL if none
+    NodeIndex getPredecessor(int commitNumber, int version) const {
+        NodeIndex predecessor = NIL;
+        NodeIndex current = rootAt(version);
+        while (current != NIL) {
+            if (commitNumber > keys[current]) {
+                predecessor = current;
+                current = getRight(current, version);
+            }
+            else {
+                current = getLeft(current, version);
+            }
+        }
+        return predecessor;
+    }
+
+private:
+    enum Field { LEFT, RIGHT, HEIGHT };
+
+    struct PathStep {
+        NodeIndex node;
+        bool wentLeft;
+    };
+
+    // balanced subtree of fresh nodes over sorted[first, last), nodes as they read at version
+    NodeIndex buildBalanced(const std::vector<NodeIndex>& sorted, size_t first, size_t last, int version) {
+        if (first >= last)
+            return NIL;
+        size_t middle = first + (last - first) / 2;
+        NodeIndex left = buildBalanced(sorted, first, middle, version);
+        NodeIndex right = buildBalanced(sorted, middle + 1, last, version);
+        int lh = getHeight(left, version);
+        int rh = getHeight(right, version);
+        return newNode(keys[sorted[middle]], payloads[sorted[middle]], left, right, 1 + (lh > rh ? lh : rh));
+    }
+
+    NodeIndex newNode(int key, uint32_t payload, NodeIndex left, NodeIndex right, int height) {
+        NodeIndex index = (NodeIndex)keys.size();
+        keys.push_back(key);
+        lefts.push_back(left);
+        rights.push_back(right);
+        heights.push_back((uint8_t)height);
+        payloads.push_back(payload);
+        modCounts.push_back(0);
+        modVersions.resize(modVersions.size() + MAX_MODS);
+        modFields.resize(modFields.size() + MAX_MODS);
+        modValues.resize(modValues.size() + MAX_MODS);
+        return index;
+    }
+
+    // The log is appended in version order, so the newest matching entry found walking back wins
+    uint32_t readField(NodeIndex node, Field field, uint32_t base, int version) const {
+        size_t first = (size_t)node * MAX_MODS;
+        size_t i = first + modCounts[node];
+        while (i > first) {
+            i--;
+            if (modFields[i] == field && modVersions[i] <= version)
+                return modValues[i];
+        }
+        return base;
+    }
+
+    // Records a field change in the mod log, full nodes get copied with the change applied
+    NodeIndex updateField(NodeIndex node, Field field, uint32_t value, int version) {
+        if (modCounts[node] < MAX_MODS) {
+            size_t slot = (size_t)node * MAX_MODS + modCounts[node];
+            modVersions[slot] = version;
+            modFields[slot] = (uint8_t)field;
+            modValues[slot] = value;
+            modCounts[node]++;
+            return node;
+        }
+        NodeIndex copy = newNode(keys[node], payloads[node], getLeft(node, version),
+            getRight(node, version), getHeight(node, version));
+        if (field == LEFT) lefts[copy] = value;
+        else if (field == RIGHT) rights[copy] = value;
+        else heights[copy] = (uint8_t)value;
+        return copy;
+    }
+
+    NodeIndex refreshHeight(NodeIndex node, int version) {
+        int lh = getHeight(getLeft(node, version), version);
+        int rh = getHeight(getRight(node, version), version);
+        int h = 1 + (lh > rh ? lh : rh);
+        if (h == getHeight(node, version))
+            return node;
+        return updateField(node, HEIGHT, (uint32_t)h, version);
+    }
+
+    NodeIndex rotateRight(NodeIndex y, int version) {
+        NodeIndex x = getLeft(y, version);
+        y = updateField(y, LEFT, getRight(x, version), version);
+        y = refreshHeight(y, version);
+        x = updateField(x, RIGHT, y, version);
+        return refreshHeight(x, version);
+    }
+
+    NodeIndex rotateLeft(NodeIndex x, int version) {
+        NodeIndex y = getRight(x, version);
+        x = updateField(x, RIGHT, getLeft(y, version), version);
+        x = refreshHeight(x, version);
+        y = updateField(y, LEFT, x, version);
+        return refreshHeight(y, version);
+    }
+
+    NodeIndex rebalance(NodeIndex node, int version) {
+        NodeIndex left = getLeft(node, version);
+        NodeIndex right = getRight(node, version);
+        int balance = getHeight(left, version) - getHeight(right, version);
+        if (balance > 1) {
+            // left right case turns into left left first
+            if (getHeight(getLeft(left, version), version) < getHeight(getRight(left, version), version))
+                node = updateField(node, LEFT, rotateLeft(left, version), version);
+            return rotateRight(node, version);
+        }
+        if (balance < -1) {
+            // right left case turns into right right first
+            if (getHeight(getRight(right, version), version) < getHeight(getLeft(right, version), version))
+                node = updateField(node, RIGHT, rotateRight(right, version), version);
+            return rotateLeft(node, version);
+        }
+        return node;
+    }
+
+    std::vector<NodeIndex> versionRoots;     // root of every version, version 0 is the empty tree
+
+    // node pools, one entry per node
+    std::vector<int> keys;
+    std::vector<NodeIndex> lefts;
+    std::vector<NodeIndex> rights;
+    std::vector<uint8_t> heights;
+    std::vector<uint32_t> payloads;
+    std::vector<uint8_t> modCounts;
+
+    // mod pools, MAX_MODS entries per node
+    std::vector<int> modVersions;
+    std::vector<uint8_t> modFields;
+    std::vector<uint32_t> modValues;
+
+    // payload records, one per commit no matter how often its node is copied
+    std::vector<CommitInfo> commits;
+
+    // scratch path reused by insertNode
+    std::vector<PathStep> path;
+};
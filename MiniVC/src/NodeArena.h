@@ -0,0 +1,127 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+
+// Slab allocator backing every node of one commit history.
+// Slots are carved out of large slabs and recycled per size class, so
+// the tree never goes to the general heap once the slabs are warm.
+// release() hands every slab back at once when the history is closed or reloaded.
+class NodeArena {
+public:
+    explicit NodeArena(size_t bytesPerSlab = 256 * 1024)
+        : slabBytes(bytesPerSlab), reservedBytes(0), liveBytes(0) {
+    }
+
+    ~NodeArena() {
+        release();
+    }
+
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    void* allocate(size_t bytes) {
+        SizeClass& sc = classFor(bytes);
+        liveBytes += sc.slotSize;
+        // reuse a slot freed earlier (nodes dropped by path copying)
+        if (sc.freeList) {
+            FreeSlot* slot = sc.freeList;
+            sc.freeList = slot->next;
+            return slot;
+        }
+        if (sc.cursor == sc.end) {
+            size_t bytesForSlab = slabBytes - slabBytes % sc.slotSize;
+            if (bytesForSlab == 0)
+                bytesForSlab = sc.slotSize;
+            slabs.emplace_back(new char[bytesForSlab]);
+            reservedBytes += bytesForSlab;
+            sc.cursor = slabs.back().get();
+            sc.end = sc.cursor + bytesForSlab;
+        }
+        void* result = sc.cursor;
+        sc.cursor += sc.slotSize;
+        return result;
+    }
+
+    void deallocate(void* p, size_t bytes) {
+        SizeClass& sc = classFor(bytes);
+        liveBytes -= sc.slotSize;
+        FreeSlot* slot = static_cast<FreeSlot*>(p);
+        slot->next = sc.freeList;
+        sc.freeList = slot;
+    }
+
+    // Frees every slab in one go. Refuses while nodes are still alive, the
+    // caller has to drop its roots first so node destructors have run.
+    bool release() {
+        if (liveBytes != 0)
+            return false;
+        slabs.clear();
+        classes.clear();
+        reservedBytes = 0;
+        return true;
+    }
+
+    size_t bytesReserved() const { return reservedBytes; }
+    size_t bytesInUse() const { return liveBytes; }
+
+private:
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+
+    struct SizeClass {
+        size_t slotSize;
+        char* cursor;
+        char* end;
+        FreeSlot* freeList;
+    };
+
+    // One size class per distinct allocation size, there are only a handful of node types
+    SizeClass& classFor(size_t bytes) {
+        const size_t align = alignof(std::max_align_t);
+        if (bytes < sizeof(FreeSlot))
+            bytes = sizeof(FreeSlot);
+        size_t slotSize = (bytes + align - 1) / align * align;
+        for (auto& sc : classes) {
+            if (sc.slotSize == slotSize)
+                return sc;
+        }
+        classes.push_back({ slotSize, nullptr, nullptr, nullptr });
+        return classes.back();
+    }
+
+    size_t slabBytes;
+    std::vector<std::unique_ptr<char[]>> slabs;
+    std::vector<SizeClass> classes;
+    size_t reservedBytes;
+    size_t liveBytes;
+};
+
+
+// std allocator adaptor so std::allocate_shared places the node and its control block in the arena
+template <class T>
+struct ArenaAllocator {
+    typedef T value_type;
+    NodeArena* arena;
+
+    explicit ArenaAllocator(NodeArena& a) : arena(&a) {}
+
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(arena->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) {
+        arena->deallocate(p, n * sizeof(T));
+    }
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena == b.arena; }
+
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena != b.arena; }
@@ -76,6 +76,14 @@ extern "C" __declspec(dllexport) void beNotified(SCNotification *notifyCode)
 		}
 		break;
 
+		// a saved buffer may have just got its first real path
+		case NPPN_BUFFERACTIVATED:
+		case NPPN_FILESAVED:
+		{
+			activateBuffer();
+		}
+		break;
+
 		default:
 			return;
 	}
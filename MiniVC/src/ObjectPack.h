@@ -0,0 +1,363 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "CommitImage.h"
+#include "ContentHash.h"
+#include "FileIO.h"
+
+
+// Every object of a file's history in one append-only file, objects.pack in its folder: the
+// texts as blobs, the commits and the rollbacks. A commit is one sequential append, reads seek
+// straight to a record through an offset index kept in memory, and nothing lists the folder.
+// Reads come out of a read-only mapping of the pack, large objects are decoded in place.
+// objects.idx saves the index whenever the image is written; opening reads it and walks only
+// the records appended since, which are also the changes the image does not hold yet.
+//
+// Record: PackRecordHeader, then the body.
+//   PACK_BLOB       key: content hash of the text. body: a stored object (BlockCodec.h) of the
+//                   text when depth is 0, otherwise of the hash of an older blob followed by a
+//                   delta (DeltaCodec.h) that turns that blob's text into this one
+//   DELTA_COMMIT    key: commit number. body: the hash of its blob, then the commit as UTF-16
+//                   in the layout of encodeDeltaBody (CommitImage.h)
+//   DELTA_TRUNCATE  key: commit number. body: the same, every commit after it is gone
+// A record cut short or damaged by a crash ends the pack, open cuts it off the file.
+
+const uint32_t PACK_BLOB = 3;
+const char PACK_INDEX_MAGIC[8] = { 'M', 'i', 'n', 'i', 'V', 'C', 'i', 'x' };
+
+struct PackRecordHeader {
+    uint32_t type;
+    uint32_t bodyBytes;
+    uint32_t check;             // FNV-1a of the body
+    uint32_t depth;             // blobs: deltas to the nearest whole text, 0 for a whole one
+    uint8_t key[32];            // content hash, or the commit number little-endian in the first 4 bytes
+};
+
+// objects.idx: the header, then one entry per blob and per live commit
+struct PackIndexHeader {
+    char magic[8];
+    uint64_t packBytes;         // pack length the entries cover
+    uint64_t entries;
+    uint64_t reserved;
+};
+
+struct PackIndexEntry {
+    uint32_t type;
+    uint32_t bytes;
+    uint32_t depth;
+    uint32_t reserved;
+    uint64_t offset;
+    uint8_t key[32];
+};
+
+static_assert(sizeof(PackRecordHeader) == 48, "pack record layout");
+static_assert(sizeof(PackIndexHeader) == 32, "pack index header layout");
+static_assert(sizeof(PackIndexEntry) == 56, "pack index entry layout");
+
+
+// where a record's body is
+struct PackEntry {
+    uint64_t offset;
+    uint32_t bytes;
+    uint32_t depth;
+};
+
+
+uint32_t packChecksum(const char* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// a body this large past the end of the mapping gets the pack mapped again rather than read
+const uint64_t PACK_REMAP_BYTES = 1 << 20;
+
+
+class ObjectPack {
+public:
+    ObjectPack() = default;
+    ObjectPack(const ObjectPack&) = delete;
+    ObjectPack& operator=(const ObjectPack&) = delete;
+    ~ObjectPack() { close(); }
+
+    // Opens the pack at path, or creates it, and builds the index from indexPath and the records
+    // after what it covers. Whatever follows the last whole record is cut off, so no part of a
+    // torn record is left behind the next append. created tells whether the pack is new. False
+    // if it can't be opened
+    bool open(const std::wstring& path, const std::wstring& indexPath, bool& created) {
+        close();
+        created = false;
+        fp = openFile(path, L"r+b");
+        if (!fp) {
+            fp = openFile(path, L"w+b");
+            created = true;
+        }
+        if (!fp)
+            return false;
+        // every read and write is one whole record or more, stdio's buffer would only copy them
+        setvbuf(fp, nullptr, _IONBF, 0);
+        packFile = path;
+        uint64_t size = fileLength(fp);
+        view.open(path);
+        if (!loadIndex(indexPath, size)) {
+            blobs.clear();
+            commits.clear();
+            indexed = 0;
+        }
+        end = walk(indexed, size, nullptr);
+        if (end < size) {
+            // unmapped first, Windows refuses to shrink a mapped file
+            view.close();
+            truncateFile(fp, end);
+            view.open(path);
+        }
+        return true;
+    }
+
+    void close() {
+        if (fp)
+            fclose(fp);
+        fp = nullptr;
+        view.close();
+        blobs.clear();
+        commits.clear();
+        pending.clear();
+        end = indexed = 0;
+    }
+
+    bool isOpen() const { return fp != nullptr; }
+    uint64_t bytes() const { return end; }
+    uint64_t indexedBytes() const { return indexed; }     // what objects.idx covered when the pack was opened
+    size_t blobCount() const { return blobs.size(); }
+
+    const PackEntry* blob(const ContentHash& hash) const {
+        auto found = blobs.find(std::string((const char*)hash.bytes, 32));
+        return found == blobs.end() ? nullptr : &found->second;
+    }
+
+    const PackEntry* commit(int commitNumber) const {
+        auto found = commits.find(commitNumber);
+        return found == commits.end() ? nullptr : &found->second;
+    }
+
+    // The body exactly as it was added, in place in the mapping or, where that does not reach,
+    // read into buffer with one seek and one read. Good until the next read
+    bool read(const PackEntry& entry, FileSpan& body, std::string& buffer) {
+        return fetch(entry.offset, entry.bytes, body, buffer);
+    }
+
+    // Records are queued, flush writes everything queued at the end of the pack in one write
+    void addBlob(const ContentHash& hash, uint32_t depth, const std::string& body) {
+        PackRecordHeader head = PackRecordHeader();
+        head.type = PACK_BLOB;
+        head.depth = depth;
+        memcpy(head.key, hash.bytes, 32);
+        queue(head, body);
+    }
+
+    void addRecord(uint32_t type, const CommitInfo& commit, const ContentHash& blobHash) {
+        std::vector<uint16_t> units = encodeDeltaBody(type, commit);
+        std::string body((const char*)blobHash.bytes, 32);
+        body.append((const char*)units.data(), units.size() * sizeof(uint16_t));
+        PackRecordHeader head = PackRecordHeader();
+        head.type = type;
+        uint32_t key = (uint32_t)commit.commitNumber;
+        for (int i = 0; i < 4; i++)
+            head.key[i] = (uint8_t)(key >> (8 * i));
+        queue(head, body);
+    }
+
+    // False if the write failed, the queued records are dropped and the index is as before
+    bool flush() {
+        if (pending.empty())
+            return true;
+        bool written = fp && seekFile(fp, end) && fwrite(pending.data(), 1, pending.size(), fp) == pending.size()
+            && fflush(fp) == 0;
+        if (written) {
+            for (size_t at = 0; at < pending.size(); ) {
+                PackRecordHeader head;
+                memcpy(&head, pending.data() + at, sizeof(head));
+                index(head, end + at + sizeof(head));
+                at += sizeof(head) + head.bodyBytes;
+            }
+            end += pending.size();
+        }
+        pending.clear();
+        return written;
+    }
+
+    // Commit and truncate records from offset from on, in the order they were added
+    std::vector<DeltaRecord> records(uint64_t from) {
+        std::vector<DeltaRecord> out;
+        walk(from, end, &out);
+        return out;
+    }
+
+    // Saves the index as of the end of the pack, written aside and moved over the old one
+    bool writeIndex(const std::wstring& indexPath) {
+        std::vector<PackIndexEntry> entries;
+        entries.reserve(blobs.size() + commits.size());
+        for (const auto& blobEntry : blobs) {
+            PackIndexEntry entry = toIndexEntry(PACK_BLOB, blobEntry.second);
+            memcpy(entry.key, blobEntry.first.data(), 32);
+            entries.push_back(entry);
+        }
+        for (const auto& commitEntry : commits) {
+            PackIndexEntry entry = toIndexEntry(DELTA_COMMIT, commitEntry.second);
+            for (int i = 0; i < 4; i++)
+                entry.key[i] = (uint8_t)((uint32_t)commitEntry.first >> (8 * i));
+            entries.push_back(entry);
+        }
+        PackIndexHeader header = PackIndexHeader();
+        memcpy(header.magic, PACK_INDEX_MAGIC, sizeof(header.magic));
+        header.packBytes = end;
+        header.entries = entries.size();
+
+        std::wstring aside = indexPath + L".tmp";
+        FILE* fpOut = openFile(aside, L"wb");
+        if (!fpOut)
+            return false;
+        FileWriter out(fpOut);
+        out.write(&header, sizeof(header));
+        if (!entries.empty())
+            out.write(entries.data(), entries.size() * sizeof(PackIndexEntry));
+        bool written = out.finish();
+        written = fclose(fpOut) == 0 && written;
+        if (!written || !replaceFile(aside, indexPath))
+            return false;
+        indexed = end;
+        return true;
+    }
+
+private:
+    // bytes [offset, offset + size) of the pack, see read
+    bool fetch(uint64_t offset, uint64_t size, FileSpan& span, std::string& buffer) {
+        if (!view.covers(offset, size) && size >= PACK_REMAP_BYTES)
+            view.open(packFile);
+        if (view.covers(offset, size)) {
+            span = FileSpan{ view.data() + offset, (size_t)size };
+            return true;
+        }
+        buffer.resize((size_t)size);
+        if (!fp || !seekFile(fp, offset) || (size != 0 && fread(&buffer[0], 1, buffer.size(), fp) != buffer.size()))
+            return false;
+        span = FileSpan{ buffer.data(), buffer.size() };
+        return true;
+    }
+
+    void queue(PackRecordHeader& head, const std::string& body) {
+        head.bodyBytes = (uint32_t)body.size();
+        head.check = packChecksum(body.data(), body.size());
+        pending.append((const char*)&head, sizeof(head));
+        pending += body;
+    }
+
+    static PackIndexEntry toIndexEntry(uint32_t type, const PackEntry& packEntry) {
+        PackIndexEntry entry = PackIndexEntry();
+        entry.type = type;
+        entry.bytes = packEntry.bytes;
+        entry.depth = packEntry.depth;
+        entry.offset = packEntry.offset;
+        return entry;
+    }
+
+    static int keyCommit(const uint8_t key[32]) {
+        return (int)(key[0] | ((uint32_t)key[1] << 8) | ((uint32_t)key[2] << 16) | ((uint32_t)key[3] << 24));
+    }
+
+    void index(const PackRecordHeader& head, uint64_t bodyOffset) {
+        PackEntry entry = { bodyOffset, head.bodyBytes, head.depth };
+        if (head.type == PACK_BLOB) {
+            blobs[std::string((const char*)head.key, 32)] = entry;
+            return;
+        }
+        int commitNumber = keyCommit(head.key);
+        if (head.type == DELTA_COMMIT)
+            commits[commitNumber] = entry;
+        else if (head.type == DELTA_TRUNCATE)
+            commits.erase(commits.upper_bound(commitNumber), commits.end());
+    }
+
+    // Reads the records in [from, size) and returns where the last whole one ends. Builds the
+    // index when replay is null, otherwise decodes commits and truncates into it
+    uint64_t walk(uint64_t from, uint64_t size, std::vector<DeltaRecord>* replay) {
+        uint64_t at = from;
+        std::string buffer;
+        std::vector<uint16_t> units;
+        while (at + sizeof(PackRecordHeader) <= size) {
+            PackRecordHeader head;
+            FileSpan span;
+            if (!fetch(at, sizeof(head), span, buffer))
+                break;
+            memcpy(&head, span.data, sizeof(head));
+            bool known = head.type == PACK_BLOB || head.type == DELTA_COMMIT || head.type == DELTA_TRUNCATE;
+            if (!known || head.bodyBytes > size - at - sizeof(head))
+                break;
+            uint64_t bodyOffset = at + sizeof(head);
+            // replaying skips the texts, they were checked when the pack was opened
+            if (!replay || head.type != PACK_BLOB) {
+                if (!fetch(bodyOffset, head.bodyBytes, span, buffer))
+                    break;
+                if (!replay && packChecksum(span.data, span.size) != head.check)
+                    break;
+            }
+            if (replay && head.type != PACK_BLOB) {
+                DeltaRecord record;
+                if (span.size < 32 || (span.size - 32) % 2 != 0)
+                    break;
+                units.resize((span.size - 32) / 2);
+                if (!units.empty())
+                    memcpy(units.data(), span.data + 32, units.size() * 2);
+                if (!decodeDeltaBody(head.type, units.data(), units.size(), record))
+                    break;
+                replay->push_back(record);
+            }
+            if (!replay)
+                index(head, bodyOffset);
+            at = bodyOffset + head.bodyBytes;
+        }
+        return at;
+    }
+
+    // false if indexPath is missing or does not fit the pack
+    bool loadIndex(const std::wstring& indexPath, uint64_t size) {
+        std::string contents;
+        if (!readFile(indexPath, contents) || contents.size() < sizeof(PackIndexHeader))
+            return false;
+        PackIndexHeader header;
+        memcpy(&header, contents.data(), sizeof(header));
+        if (memcmp(header.magic, PACK_INDEX_MAGIC, sizeof(header.magic)) != 0 || header.packBytes > size
+            || header.entries != (contents.size() - sizeof(header)) / sizeof(PackIndexEntry))
+            return false;
+        for (uint64_t i = 0; i < header.entries; i++) {
+            PackIndexEntry entry;
+            memcpy(&entry, contents.data() + sizeof(header) + i * sizeof(PackIndexEntry), sizeof(entry));
+            if (entry.offset > header.packBytes || entry.bytes > header.packBytes - entry.offset)
+                return false;
+            PackEntry packEntry = { entry.offset, entry.bytes, entry.depth };
+            if (entry.type == PACK_BLOB)
+                blobs[std::string((const char*)entry.key, 32)] = packEntry;
+            else
+                commits[keyCommit(entry.key)] = packEntry;
+        }
+        indexed = header.packBytes;
+        return true;
+    }
+
+    FILE* fp = nullptr;
+    std::wstring packFile;
+    MappedFile view;            // the pack as of when it was last mapped
+    uint64_t end = 0;           // end of the last whole record, where the next append goes
+    uint64_t indexed = 0;
+    std::unordered_map<std::string, PackEntry> blobs;     // by the 32 bytes of the hash
+    std::map<int, PackEntry> commits;                     // live commits only
+    std::string pending;        // records queued for the next flush
+};
@@ -0,0 +1,383 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include "CommitTree.h"
+
+
+// Partially persistent AVL tree generic over key, payload and the way old versions are kept.
+// The policy is a template argument, so there is no runtime dispatch on the hot paths.
+//
+// A policy supplies Fields<NodePtr>: left, right and height of one node as of a version,
+// plus log*() calls that record a change in place and return false when the node cannot
+// take it. The tree then copies the node with the change applied and relinks the copy
+// from the parent, which goes through the same path.
+//
+// Nodes are linked by raw pointers and owned by the tree until it is destroyed, every
+// version stays readable for the life of the tree.
+
+
+// Driscoll fat node with a bounded log per field, copied once any log is full.
+// CommitNode in CommitTree.h is this scheme with Capacity MINIVC_MAX_MODS, 3 by default.
+template <int Capacity>
+struct FatNodePolicy {
+    static const char* name() { return "fat node"; }
+
+    template <class NodePtr>
+    struct Fields {
+        NodePtr left;
+        NodePtr right;
+        int height;
+        ModificationLog<NodePtr, Capacity> leftMods;
+        ModificationLog<NodePtr, Capacity> rightMods;
+        ModificationLog<int, Capacity> heightMods;
+
+        Fields(NodePtr l, NodePtr r, int h) : left(l), right(r), height(h) {}
+
+        NodePtr getLeft(int version) const { return leftMods.at(left, version); }
+        NodePtr getRight(int version) const { return rightMods.at(right, version); }
+        int getHeight(int version) const { return heightMods.at(height, version); }
+
+        bool logLeft(int version, NodePtr value) {
+            if (leftMods.full()) return false;
+            leftMods.append(version, value);
+            return true;
+        }
+        bool logRight(int version, NodePtr value) {
+            if (rightMods.full()) return false;
+            rightMods.append(version, value);
+            return true;
+        }
+        bool logHeight(int version, int value) {
+            if (heightMods.full()) return false;
+            heightMods.append(version, value);
+            return true;
+        }
+    };
+};
+
+
+// Driscoll node copying: Slots spare entries per node shared by all fields, copied once they are used up
+template <int Slots>
+struct NodeCopyingPolicy {
+    static const char* name() { return "node copying"; }
+
+    template <class NodePtr>
+    struct Fields {
+        enum Field { LEFT, RIGHT, HEIGHT };
+
+        struct Mod {
+            int version;
+            int field;
+            NodePtr child;
+            int height;
+        };
+
+        NodePtr left;
+        NodePtr right;
+        int height;
+        Mod mods[Slots];
+        int count;
+
+        Fields(NodePtr l, NodePtr r, int h) : left(l), right(r), height(h), count(0) {}
+
+        NodePtr getLeft(int version) const {
+            const Mod* mod = find(LEFT, version);
+            return mod ? mod->child : left;
+        }
+        NodePtr getRight(int version) const {
+            const Mod* mod = find(RIGHT, version);
+            return mod ? mod->child : right;
+        }
+        int getHeight(int version) const {
+            const Mod* mod = find(HEIGHT, version);
+            return mod ? mod->height : height;
+        }
+
+        bool logLeft(int version, NodePtr value) { return append(version, LEFT, value, 0); }
+        bool logRight(int version, NodePtr value) { return append(version, RIGHT, value, 0); }
+        bool logHeight(int version, int value) { return append(version, HEIGHT, NodePtr(), value); }
+
+    private:
+        // entries are in version order, the newest match not newer than version wins
+        const Mod* find(int field, int version) const {
+            for (int i = count; i > 0; i--) {
+                const Mod& mod = mods[i - 1];
+                if (mod.field == field && mod.version <= version)
+                    return &mod;
+            }
+            return nullptr;
+        }
+
+        bool append(int version, int field, NodePtr child, int value) {
+            if (count == Slots) return false;
+            mods[count].version = version;
+            mods[count].field = field;
+            mods[count].child = child;
+            mods[count].height = value;
+            count++;
+            return true;
+        }
+    };
+};
+
+
+// Plain path copying: nodes never change, every insert copies the path from the root
+struct PathCopyingPolicy {
+    static const char* name() { return "path copying"; }
+
+    template <class NodePtr>
+    struct Fields {
+        NodePtr left;
+        NodePtr right;
+        int height;
+
+        Fields(NodePtr l, NodePtr r, int h) : left(l), right(r), height(h) {}
+
+        NodePtr getLeft(int) const { return left; }
+        NodePtr getRight(int) const { return right; }
+        int getHeight(int) const { return height; }
+
+        bool logLeft(int, NodePtr) { return false; }
+        bool logRight(int, NodePtr) { return false; }
+        bool logHeight(int, int) { return false; }
+    };
+};
+
+
+template <class Key, class Payload, class Policy>
+class PersistentTree {
+public:
+    struct Node;
+    typedef Node* NodePtr;
+    typedef typename Policy::template Fields<NodePtr> Fields;
+
+    struct Node {
+        Key key;
+        uint32_t payload;     // index into payloads, shared by every copy of the node
+        Fields fields;
+
+        Node(const Key& k, uint32_t p, NodePtr l, NodePtr r, int h) : key(k), payload(p), fields(l, r, h) {}
+    };
+
+    PersistentTree() : roots(1, nullptr) {}
+
+    PersistentTree(const PersistentTree&) = delete;
+    PersistentTree& operator=(const PersistentTree&) = delete;
+
+    int latestVersion() const { return (int)roots.size() - 1; }
+
+    // root as of version, versions past the newest read the newest
+    NodePtr rootAt(int version) const {
+        if (version < 0) return roots.front();
+        if (version >= (int)roots.size()) return roots.back();
+        return roots[version];
+    }
+
+    const Payload& payloadOf(NodePtr node) const { return payloads[node->payload]; }
+    size_t nodeCount() const { return nodes.size(); }
+
+    // Bytes held by the nodes, payloads excluded
+    size_t nodeBytes() const { return nodes.size() * sizeof(Node); }
+
+    // adds key as a new version and returns that version
+    int insert(const Key& key, const Payload& payload) {
+        int version = latestVersion() + 1;
+        payloads.push_back(payload);
+        NodePtr fresh = newNode(key, (uint32_t)(payloads.size() - 1), nullptr, nullptr, 1);
+        NodePtr root = roots.back();
+        if (!root) {
+            roots.push_back(fresh);
+            return version;
+        }
+
+        // walk down once and remember the path
+        path.clear();
+        for (NodePtr current = root; current; ) {
+            bool goLeft = key < current->key;
+            path.push_back(PathStep{ current, goLeft });
+            current = goLeft ? getLeft(current, version) : getRight(current, version);
+        }
+
+        // walk back up relinking, stops once a subtree keeps its root and its height
+        NodePtr child = fresh;
+        size_t depth = path.size();
+        while (depth > 0) {
+            depth--;
+            NodePtr original = path[depth].node;
+            int oldHeight = getHeight(original, version);
+            NodePtr node = original;
+            if (path[depth].wentLeft) {
+                if (getLeft(node, version) != child)
+                    node = setLeft(node, child, version);
+            }
+            else {
+                if (getRight(node, version) != child)
+                    node = setRight(node, child, version);
+            }
+            node = refreshHeight(node, version);
+            node = rebalance(node, version);
+            child = node;
+            if (node == original && getHeight(node, version) == oldHeight) {
+                roots.push_back(root);
+                return version;
+            }
+        }
+        roots.push_back(child);
+        return version;
+    }
+
+    // node holding key as of version, null if it is not in the tree
+    NodePtr search(const Key& key, int version) const {
+        NodePtr current = rootAt(version);
+        while (current) {
+            if (key < current->key)
+                current = getLeft(current, version);
+            else if (current->key < key)
+                current = getRight(current, version);
+            else
+                return current;
+        }
+        return nullptr;
+    }
+
+    // first node after key as of version, null if none
+    NodePtr successor(const Key& key, int version) const {
+        NodePtr found = nullptr;
+        for (NodePtr current = rootAt(version); current; ) {
+            if (key < current->key) {
+                found = current;
+                current = getLeft(current, version);
+            }
+            else {
+                current = getRight(current, version);
+            }
+        }
+        return found;
+    }
+
+    // last node before key as of version, null if none
+    NodePtr predecessor(const Key& key, int version) const {
+        NodePtr found = nullptr;
+        for (NodePtr current = rootAt(version); current; ) {
+            if (current->key < key) {
+                found = current;
+                current = getRight(current, version);
+            }
+            else {
+                current = getLeft(current, version);
+            }
+        }
+        return found;
+    }
+
+    // calls visit(node) for every node as of version, in key order
+    template <class Visitor>
+    void forEach(int version, Visitor visit) const {
+        std::vector<NodePtr> stack;
+        NodePtr current = rootAt(version);
+        while (current || !stack.empty()) {
+            while (current) {
+                stack.push_back(current);
+                current = getLeft(current, version);
+            }
+            current = stack.back();
+            stack.pop_back();
+            visit(current);
+            current = getRight(current, version);
+        }
+    }
+
+    static NodePtr getLeft(NodePtr node, int version) { return node->fields.getLeft(version); }
+    static NodePtr getRight(NodePtr node, int version) { return node->fields.getRight(version); }
+    static int getHeight(NodePtr node, int version) { return node ? node->fields.getHeight(version) : 0; }
+
+private:
+    struct PathStep {
+        NodePtr node;
+        bool wentLeft;
+    };
+
+    NodePtr newNode(const Key& key, uint32_t payload, NodePtr left, NodePtr right, int height) {
+        nodes.emplace_back(key, payload, left, right, height);
+        return &nodes.back();
+    }
+
+    // the node as it is at version, with no log entries of its own
+    NodePtr copyNode(NodePtr node, int version) {
+        return newNode(node->key, node->payload, getLeft(node, version), getRight(node, version), getHeight(node, version));
+    }
+
+    NodePtr setLeft(NodePtr node, NodePtr value, int version) {
+        if (node->fields.logLeft(version, value))
+            return node;
+        NodePtr copy = copyNode(node, version);
+        copy->fields.left = value;
+        return copy;
+    }
+
+    NodePtr setRight(NodePtr node, NodePtr value, int version) {
+        if (node->fields.logRight(version, value))
+            return node;
+        NodePtr copy = copyNode(node, version);
+        copy->fields.right = value;
+        return copy;
+    }
+
+    NodePtr setHeight(NodePtr node, int value, int version) {
+        if (node->fields.logHeight(version, value))
+            return node;
+        NodePtr copy = copyNode(node, version);
+        copy->fields.height = value;
+        return copy;
+    }
+
+    NodePtr refreshHeight(NodePtr node, int version) {
+        int lh = getHeight(getLeft(node, version), version);
+        int rh = getHeight(getRight(node, version), version);
+        int h = 1 + (lh > rh ? lh : rh);
+        if (h == getHeight(node, version))
+            return node;
+        return setHeight(node, h, version);
+    }
+
+    NodePtr rotateRight(NodePtr y, int version) {
+        NodePtr x = getLeft(y, version);
+        y = setLeft(y, getRight(x, version), version);
+        y = refreshHeight(y, version);
+        x = setRight(x, y, version);
+        return refreshHeight(x, version);
+    }
+
+    NodePtr rotateLeft(NodePtr x, int version) {
+        NodePtr y = getRight(x, version);
+        x = setRight(x, getLeft(y, version), version);
+        x = refreshHeight(x, version);
+        y = setLeft(y, x, version);
+        return refreshHeight(y, version);
+    }
+
+    NodePtr rebalance(NodePtr node, int version) {
+        NodePtr left = getLeft(node, version);
+        NodePtr right = getRight(node, version);
+        int balance = getHeight(left, version) - getHeight(right, version);
+        if (balance > 1) {
+            // left right case turns into left left first
+            if (getHeight(getLeft(left, version), version) < getHeight(getRight(left, version), version))
+                node = setLeft(node, rotateLeft(left, version), version);
+            return rotateRight(node, version);
+        }
+        if (balance < -1) {
+            // right left case turns into right right first
+            if (getHeight(getRight(right, version), version) < getHeight(getLeft(right, version), version))
+                node = setRight(node, rotateRight(right, version), version);
+            return rotateLeft(node, version);
+        }
+        return node;
+    }
+
+    std::vector<NodePtr> roots;
+    std::deque<Node> nodes;          // never moves a node once placed
+    std::vector<Payload> payloads;
+    std::vector<PathStep> path;      // scratch path reused by insert
+};
@@ -28,9 +28,19 @@
 #include <cstdio>
 #include <sstream>
 #include <shlobj.h>
-#include "CommitTree.h"
+#include "CommitRepository.h"
+#include "CommitImage.h"
+#include "FileIO.h"
+#include "DeltaCodec.h"
+#include "ContentHash.h"
+#include "BlockCodec.h"
+#include "ObjectPack.h"
+#include "HistoryLoad.h"
 #include <commctrl.h>
 #include <stdexcept>
+#include <ctime>
+#include <map>
+#include <cwctype>
 
 
 /*
@@ -42,29 +52,67 @@
 
 HINSTANCE g_hInst = NULL;
 std::wstring g_repoPath = L"F:\\CSI5610\\Repo";
-std::shared_ptr<CommitNode> g_commitTree = nullptr;
-int g_commitCounter = 1;
 static wchar_t g_commitMsgBuffer[512] = { 0 };
 HWND g_hFileListDlg = NULL;
 
 
+// History of one tracked document. Each has its own folder in the repository, its own tree and
+// its own commit numbers, so committing one file never touches another file's history.
+struct FileHistory {
+    std::wstring sourcePath;     // Full path of the document, empty for unsaved buffers and the repository root.
+    std::wstring folder;         // Holds its object pack, pack index and image.
+    CommitRepository repository;
+    ObjectPack pack;             // Texts and commits, open while the history is loaded.
+    int commitCounter = 1;       // Number the next commit of this file gets.
+    int deltaRecords = 0;        // Commits and rollbacks in the pack that the image does not hold yet.
+    bool loaded = false;         // Read from its folder, done the first time its commits are needed.
+};
+
+std::map<std::wstring, std::unique_ptr<FileHistory>> g_histories;   // Loaded histories by lower-cased path.
+std::vector<std::unique_ptr<FileHistory>> g_closedHistories;         // Closed, waiting for snapshots to be let go.
+FileHistory* g_active = nullptr;                                       // History of the active buffer.
+
+
 struct TimelineData {
-    std::vector<CommitInfo> commits;
-    std::wstring folderPath;
+    FileHistory* file;           // History being listed.
+    CommitRows rows;             // Tree version being listed, rows are fetched from it on demand.
+};
+
+
+// Text of the commit rebuilt last, so stepping through the history costs one delta per step.
+// The readers below leave each text they rebuild here and take it back out to build the next.
+struct CommitTextCache {
+    std::wstring blob;           // Blob the text came from, empty for a text read from a commit file.
+    std::string text;
 };
 
 
 struct ViewCommitContext {
+    FileHistory* file;           // History the commit belongs to.
     int currentCommit;           // The commit number currently displayed.
+    std::shared_ptr<const CommitSnapshot> snapshot;  // Tree version the dialog was opened at.
+    CommitCursor cursor;         // Pinned to the tree version the dialog was opened at, Prev/Next step it.
     std::wstring repoPath;       // The repository folder path.
+    CommitTextCache textCache;   // Last commit shown, Prev rebuilds the one before from it.
 };
 
 
 // Function Declerations
 void InitializeCommitTree(const std::wstring& repoFolder);
+FileHistory& historyFor(const std::wstring& document);
+FileHistory& activeHistory();
+FileHistory& loadedHistory();
+void loadHistory(FileHistory& file);
+void closeHistories();
+bool recordDelta(FileHistory& file, uint32_t type, const CommitInfo& commit, const ContentHash& blob);
+void foldDeltaLog(FileHistory& file);
+bool createHistoryFolder(FileHistory& file);
+std::wstring formatCommitTime(long long timestamp);
+bool parseCommitTime(const std::wstring& text, bool endOfRange, long long& timestamp);
 INT_PTR CALLBACK ViewOnlyDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam);
-void viewCommitInReadOnlyDialog(const std::wstring& fullPath);
-std::wstring computeDiffSummary(const std::string& oldText, const std::string& newText);
+void viewCommitInReadOnlyDialog(FileHistory* file, int commitNum);
+std::wstring computeDiffSummary(const std::string& oldText, const std::string& newText, CommitStats& stats);
+CommitStats parseDiffSummary(const std::wstring& diffSummary);
 std::wstring promptForCommitMessage();
 static INT_PTR CALLBACK CommitMessageDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam);
 std::wstring LoadRepoPath();
@@ -96,6 +144,7 @@ void pluginInit(HANDLE hModule)
 //
 void pluginCleanUp()
 {
+    closeHistories();
 }
 
 //
@@ -117,6 +166,7 @@ void commandMenuInit()
     setCommand(0, TEXT("Open Versioned File"), openVersionedFile, NULL, false);
     setCommand(1, TEXT("Set Repo Location"), setRepoLocation, NULL, false);
     setCommand(2, TEXT("Commit Current File"), commitCurrentFile, NULL, false);
+    setCommand(3, TEXT("Memory Statistics"), showMemoryStatistics, NULL, false);
 }
 
 //
@@ -150,7 +200,8 @@ bool setCommand(size_t index, TCHAR* cmdName, PFUNCPLUGINCMD pFunc, ShortcutKey*
 //----------------------------------------------//
 //-- STEP 4. DEFINE YOUR ASSOCIATED FUNCTIONS --//
 //----------------------------------------------//
-std::vector<std::wstring> GetTextFiles(const std::wstring& folderPath)
+std::vector<std::wstring> GetTextFiles(const std::wstring& folderPath, std::vector<long long>* fileBytes = nullptr,
+    std::vector<long long>* writeTimes = nullptr)
 {
     std::vector<std::wstring> files;
     WIN32_FIND_DATA findFileData;
@@ -164,6 +215,14 @@ std::vector<std::wstring> GetTextFiles(const std::wstring& folderPath)
             if (!(findFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
             {
                 files.push_back(findFileData.cFileName);
+                if (fileBytes)
+                    fileBytes->push_back(((long long)findFileData.nFileSizeHigh << 32) | findFileData.nFileSizeLow);
+                if (writeTimes) {
+                    // 100ns ticks since 1601 to seconds since 1970
+                    long long ticks = ((long long)findFileData.ftLastWriteTime.dwHighDateTime << 32)
+                        | findFileData.ftLastWriteTime.dwLowDateTime;
+                    writeTimes->push_back((ticks - 116444736000000000LL) / 10000000);
+                }
             }
         } while (FindNextFile(hFind, &findFileData));
         FindClose(hFind);
@@ -171,21 +230,142 @@ std::vector<std::wstring> GetTextFiles(const std::wstring& folderPath)
     return files;
 }
 
-std::string ReadFileAsString(const std::wstring& filePath)
+// Commit files of histories from before the object pack, read once to move them into it:
+// commit_N.txt holds the text, commit_N.diff the summary and commit_N.msg the message.
+std::wstring commitTextPath(const std::wstring& folder, int commit)
 {
-    FILE* fp = _wfopen(filePath.c_str(), L"rb");
-    if (!fp)
-        return "";
+    return folder + L"\\commit_" + std::to_wstring(commit) + L".txt";
+}
 
-    std::ostringstream oss;
-    char buffer[1024];
-    size_t bytesRead;
-    while ((bytesRead = fread(buffer, 1, sizeof(buffer), fp)) > 0)
-    {
-        oss.write(buffer, bytesRead);
+
+// empties the cache, false for the reader that gave up
+bool dropCachedText(CommitTextCache& cache)
+{
+    cache = CommitTextCache();
+    return false;
+}
+
+
+// Text of a commit from its file into cache, false if the file is missing
+bool readCommitFiles(const std::wstring& folder, int commit, CommitTextCache& cache)
+{
+    std::string text;
+    if (!readFile(commitTextPath(folder, commit), text))
+        return dropCachedText(cache);
+    cache.blob.clear();
+    cache.text.swap(text);
+    return true;
+}
+
+
+// A new text goes into the pack as a forward delta from the previous commit's text, so nothing
+// already written ever changes, unless that would put it PACK_DELTA_DEPTH deltas from a whole
+// text. The viewer rebuilds any commit with fewer than that many. Reverse deltas would keep the
+// newest text whole but rewrite its record on every commit, which the append-only pack cannot.
+// The price is on reads: at the end of a full chain the newest text costs about 3.5x a whole read
+// (`bench codec`: 2 ms against 0.6 ms for 880 KB, 11 ms against 3.3 ms for 4.4 MB), and
+// stepping through the history from there costs one delta per step through CommitTextCache.
+const uint32_t PACK_DELTA_DEPTH = 16;
+
+std::wstring packPath(const std::wstring& folder) { return folder + L"\\objects.pack"; }
+std::wstring packIndexPath(const std::wstring& folder) { return folder + L"\\objects.idx"; }
+
+
+// The blob holding a commit's text, false if the pack does not have the commit
+bool commitBlob(FileHistory& file, int commit, ContentHash& hash)
+{
+    const PackEntry* entry = file.pack.commit(commit);
+    FileSpan body;
+    std::string buffer;
+    if (!entry || !file.pack.read(*entry, body, buffer) || body.size < 32)
+        return false;
+    memcpy(hash.bytes, body.data, 32);
+    return true;
+}
+
+
+// Text of a blob in the pack into cache, rebuilt from the whole text before it through the
+// deltas after that, each decoded straight out of the mapped pack. Stops early at the cached
+// blob. False if a link is missing or damaged
+bool readPackBlob(FileHistory& file, const ContentHash& hash, CommitTextCache& cache)
+{
+    std::vector<std::string> deltas;
+    std::string text, buffer;
+    std::wstring blob = hash.hex();
+    for (ContentHash current = hash; ; ) {
+        if (!cache.blob.empty() && cache.blob == current.hex()) {
+            text.swap(cache.text);
+            break;
+        }
+        const PackEntry* entry = file.pack.blob(current);
+        FileSpan stored;
+        std::string body;
+        if (!entry || !file.pack.read(*entry, stored, buffer) || !unpackObject(stored.data, stored.size, body))
+            return dropCachedText(cache);
+        if (entry->depth == 0) {
+            text.swap(body);
+            break;
+        }
+        if (body.size() < 32 || deltas.size() >= PACK_DELTA_DEPTH)
+            return dropCachedText(cache);
+        memcpy(current.bytes, body.data(), 32);
+        deltas.push_back(body.substr(32));
     }
-    fclose(fp);
-    return oss.str();
+    for (size_t i = deltas.size(); i > 0; i--) {
+        std::string newer;
+        if (!applyDelta(text, deltas[i - 1], newer))
+            return dropCachedText(cache);
+        text.swap(newer);
+    }
+    cache.blob = blob;
+    cache.text.swap(text);
+    return true;
+}
+
+
+// Text of a commit into cache, from the pack or, for a commit the pack does not have, from
+// its files. It stays in cache for the next one, so it is never copied on the way out. False
+// if a link is missing or damaged, the cache is empty then. An empty text is a text too, so
+// nothing may be written over with the cache unless this said true
+bool loadCommitText(FileHistory& file, int commit, CommitTextCache& cache)
+{
+    ContentHash hash;
+    if (commitBlob(file, commit, hash))
+        return readPackBlob(file, hash, cache);
+    return readCommitFiles(file.folder, commit, cache);
+}
+
+
+// Text of a commit with nothing kept for the next one, false as loadCommitText
+bool readCommitText(FileHistory& file, int commit, std::string& text)
+{
+    CommitTextCache cache;
+    bool loaded = loadCommitText(file, commit, cache);
+    text.swap(cache.text);
+    return loaded;
+}
+
+
+// Queues text as a blob unless the pack has it already, as a delta from the blob base when
+// that is smaller and keeps within PACK_DELTA_DEPTH. base is null when there is nothing to
+// delta from, baseText is its text otherwise
+void addTextBlob(FileHistory& file, const ContentHash& hash, const std::string& text,
+    const ContentHash* base, const std::string& baseText)
+{
+    if (file.pack.blob(hash))
+        return;
+    std::string whole = packObject(text);
+    const PackEntry* baseEntry = base ? file.pack.blob(*base) : nullptr;
+    if (baseEntry && baseEntry->depth + 1 < PACK_DELTA_DEPTH) {
+        std::string delta((const char*)base->bytes, 32);
+        delta += encodeDelta(baseText, text);
+        std::string stored = packObject(delta);
+        if (stored.size() < whole.size()) {
+            file.pack.addBlob(hash, baseEntry->depth + 1, stored);
+            return;
+        }
+    }
+    file.pack.addBlob(hash, 0, whole);
 }
 
 
@@ -225,46 +405,69 @@ INT_PTR CALLBACK TimelineDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM
         lvCol.cx = 200;
         ListView_InsertColumn(hList, 3, &lvCol);
 
-        // Populate the list view.
-        for (size_t i = 0; i < pData->commits.size(); i++) {
-            LVITEM lvItem = { 0 };
-            lvItem.mask = LVIF_TEXT;
-            lvItem.iItem = (int)i;
-            // Column 0: commit number
-            std::wstring commitStr = std::to_wstring(pData->commits[i].commitNumber);
-            lvItem.pszText = const_cast<LPWSTR>(commitStr.c_str());
-            ListView_InsertItem(hList, &lvItem);
+        // Column 4: Time
+        lvCol.pszText = const_cast<LPWSTR>(L"Time");
+        lvCol.cx = 110;
+        ListView_InsertColumn(hList, 4, &lvCol);
 
-            // Column 1: filename
-            ListView_SetItemText(hList, (int)i, 1, const_cast<LPWSTR>(pData->commits[i].fileName.c_str()));
+        // Column 5: Author
+        lvCol.pszText = const_cast<LPWSTR>(L"Author");
+        lvCol.cx = 80;
+        ListView_InsertColumn(hList, 5, &lvCol);
 
-            // Column 2: diff summary
-            ListView_SetItemText(hList, (int)i, 2, const_cast<LPWSTR>(pData->commits[i].diffData.c_str()));
-
-            // Column 3: commit message
-            ListView_SetItemText(hList, (int)i, 3, const_cast<LPWSTR>(pData->commits[i].commitMessage.c_str()));
-        }
+        // Rows are virtual, the list asks for their text through LVN_GETDISPINFO.
+        ListView_SetItemCountEx(hList, pData->rows.size(), LVSICF_NOINVALIDATEALL);
 
     return TRUE;
     }
 
+    case WM_NOTIFY:
+    {
+        NMHDR* header = reinterpret_cast<NMHDR*>(lParam);
+        if (header->idFrom == IDC_FILE_LIST && header->code == LVN_GETDISPINFO)
+        {
+            LVITEM& item = reinterpret_cast<NMLVDISPINFO*>(lParam)->item;
+            const CommitNode* node = pData->rows.at(item.iItem);
+            if (node && (item.mask & LVIF_TEXT))
+            {
+                std::wstring text;
+                switch (item.iSubItem) {
+                case 0: text = std::to_wstring(node->commitCounter); break;
+                case 1: text = node->payload->fileName; break;
+                case 2: text = node->payload->diffData; break;
+                case 3: text = node->payload->commitMessage; break;
+                case 4: text = formatCommitTime(node->payload->timestamp); break;
+                case 5: text = node->payload->author; break;
+                }
+                lstrcpynW(item.pszText, text.c_str(), item.cchTextMax);
+            }
+            return TRUE;
+        }
+        break;
+    }
+
     case WM_COMMAND:
         if (LOWORD(wParam) == IDOK)
         {
             HWND hList = GetDlgItem(hDlg, IDC_FILE_LIST);
             int sel = ListView_GetNextItem(hList, -1, LVNI_SELECTED);
-            if (sel != -1)
+            const CommitNode* selected = sel != -1 ? pData->rows.at(sel) : nullptr;
+            if (selected)
             {
                 // Get the commit details
-                auto commitPair = pData->commits[sel];
-                std::wstring commitFileName = commitPair.fileName;
-                std::wstring fullPath = pData->folderPath + L"\\" + commitFileName;
+                int commitNumber = selected->commitCounter;
 
                 // Check if this is the newest commit:
-                if (commitPair.commitNumber == g_commitCounter - 1)
+                if (commitNumber == pData->file->commitCounter - 1)
                 {
                     // Load the newest commit directly into Notepad++
-                    std::string fileContents = ReadFileAsString(fullPath);
+                    std::string fileContents;
+                    if (!readCommitText(*pData->file, commitNumber, fileContents))
+                    {
+                        ::MessageBox(hDlg, L"The text of this commit can't be rebuilt, objects of its history are missing or damaged.",
+                            L"Error", MB_OK | MB_ICONERROR);
+                        return TRUE;
+                    }
                     int which = -1;
                     ::SendMessage(nppData._nppHandle, NPPM_GETCURRENTSCINTILLA, 0, (LPARAM)&which);
                     if (which != -1)
@@ -280,11 +483,34 @@ INT_PTR CALLBACK TimelineDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM
                 else
                 {
                     // For an older commit, open it in the view-only dialog.
-                    viewCommitInReadOnlyDialog(fullPath);
+                    viewCommitInReadOnlyDialog(pData->file, commitNumber);
                 }
             }
             return TRUE;
         }
+        else if (LOWORD(wParam) == IDC_TIME_FILTER)
+        {
+            // Empty fields leave that end of the range open.
+            wchar_t fromText[64] = { 0 };
+            wchar_t toText[64] = { 0 };
+            GetDlgItemText(hDlg, IDC_TIME_FROM, fromText, 64);
+            GetDlgItemText(hDlg, IDC_TIME_TO, toText, 64);
+            long long from = LLONG_MIN;
+            long long to = LLONG_MAX;
+            if ((fromText[0] && !parseCommitTime(fromText, false, from)) || (toText[0] && !parseCommitTime(toText, true, to)))
+            {
+                ::MessageBox(hDlg, L"Enter times as YYYY-MM-DD or YYYY-MM-DD HH:MM.", L"Filter", MB_OK);
+                return TRUE;
+            }
+
+            pData->rows.filter(from, to);
+
+            HWND hList = GetDlgItem(hDlg, IDC_FILE_LIST);
+            ListView_SetItemState(hList, -1, 0, LVIS_SELECTED);
+            ListView_SetItemCountEx(hList, pData->rows.size(), 0);
+            InvalidateRect(hList, NULL, TRUE);
+            return TRUE;
+        }
         else if (LOWORD(wParam) == IDCANCEL)
         {
             EndDialog(hDlg, IDCANCEL);
@@ -296,6 +522,80 @@ INT_PTR CALLBACK TimelineDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM
 }
 
 
+// Local time of a commit as "YYYY-MM-DD HH:MM", empty when the commit has no time.
+std::wstring formatCommitTime(long long timestamp)
+{
+    if (timestamp <= 0)
+        return L"";
+    time_t t = (time_t)timestamp;
+    const struct tm* local = localtime(&t);
+    wchar_t buffer[32] = { 0 };
+    if (!local || wcsftime(buffer, 32, L"%Y-%m-%d %H:%M", local) == 0)
+        return L"";
+    return buffer;
+}
+
+
+// Reads a local time typed as "YYYY-MM-DD" or "YYYY-MM-DD HH:MM". A bare date is the start of
+// that day, or its last second when it ends a range.
+bool parseCommitTime(const std::wstring& text, bool endOfRange, long long& timestamp)
+{
+    int year = 0, month = 0, day = 0, hour = 0, minute = 0;
+    int fields = swscanf(text.c_str(), L"%d-%d-%d %d:%d", &year, &month, &day, &hour, &minute);
+    if (fields != 3 && fields != 5)
+        return false;
+    struct tm local = {};
+    local.tm_year = year - 1900;
+    local.tm_mon = month - 1;
+    local.tm_mday = day;
+    local.tm_hour = hour;
+    local.tm_min = minute;
+    local.tm_sec = endOfRange ? 59 : 0;
+    if (fields == 3 && endOfRange) {
+        local.tm_hour = 23;
+        local.tm_min = 59;
+    }
+    local.tm_isdst = -1;
+    time_t t = mktime(&local);
+    if (t == (time_t)-1)
+        return false;
+    timestamp = (long long)t;
+    return true;
+}
+
+
+// Windows account name for the commit, empty if it can't be read.
+std::wstring currentUserName()
+{
+    wchar_t name[257] = { 0 };
+    DWORD length = 257;
+    if (!GetUserNameW(name, &length))
+        return L"";
+    return name;
+}
+
+
+// Shows a commit's UTF-8 text in the viewer. The text is widened once, straight into the
+// buffer the edit control is given, and the text itself stays where the reader left it.
+void showCommitText(HWND hDlg, const std::string& text)
+{
+    int length = MultiByteToWideChar(CP_UTF8, 0, text.data(), (int)text.size(), NULL, 0);
+    std::wstring wide(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, text.data(), (int)text.size(), &wide[0], length);
+    SetWindowText(GetDlgItem(hDlg, IDC_VIEW_EDIT), wide.c_str());
+}
+
+
+// Shows the viewer's current commit, or says why it can't.
+void showCommit(HWND hDlg, ViewCommitContext* pContext)
+{
+    if (loadCommitText(*pContext->file, pContext->currentCommit, pContext->textCache))
+        showCommitText(hDlg, pContext->textCache.text);
+    else
+        SetWindowText(GetDlgItem(hDlg, IDC_VIEW_EDIT), L"The text of this commit can't be rebuilt, objects of its history are missing or damaged.");
+}
+
+
 // dialog procedure for view-only commits mode.
 INT_PTR CALLBACK ViewOnlyDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
 {
@@ -303,17 +603,7 @@ INT_PTR CALLBACK ViewOnlyDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM
         SetWindowLongPtr(hDlg, GWLP_USERDATA, lParam);
         ViewCommitContext* pContext = reinterpret_cast<ViewCommitContext*>(lParam);
         // Load and display the current commit file.
-        std::wstring commitFileName = L"commit_" + std::to_wstring(pContext->currentCommit) + L".txt";
-        std::wstring fullPath = pContext->repoPath + L"\\" + commitFileName;
-        std::string fileContents = ReadFileAsString(fullPath);
-
-        // Convert UTF-8 file content to wide string.
-        int size_needed = MultiByteToWideChar(CP_UTF8, 0, fileContents.c_str(), -1, NULL, 0);
-        std::wstring wcontent(size_needed, 0);
-        MultiByteToWideChar(CP_UTF8, 0, fileContents.c_str(), -1, &wcontent[0], size_needed);
-
-        HWND hEdit = GetDlgItem(hDlg, IDC_VIEW_EDIT);
-        SetWindowText(hEdit, wcontent.c_str());
+        showCommit(hDlg, pContext);
         return TRUE;
     }
 
@@ -324,33 +614,28 @@ INT_PTR CALLBACK ViewOnlyDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM
         switch (LOWORD(wParam)) {
         case IDC_PREV:
         {
-            auto pred = getPredecessor(g_commitTree, pContext->currentCommit, g_commitCounter - 1);
-            if (pred) {
-                pContext->currentCommit = pred->commitCounter;
-                std::wstring commitFileName = L"commit_" + std::to_wstring(pContext->currentCommit) + L".txt";
-                std::wstring fullPath = pContext->repoPath + L"\\" + commitFileName;
-                std::string fileContents = ReadFileAsString(fullPath);
-                int size_needed = MultiByteToWideChar(CP_UTF8, 0, fileContents.c_str(), -1, NULL, 0);
-                std::wstring wcontent(size_needed, 0);
-                MultiByteToWideChar(CP_UTF8, 0, fileContents.c_str(), -1, &wcontent[0], size_needed);
-                HWND hEdit = GetDlgItem(hDlg, IDC_VIEW_EDIT);
-                SetWindowText(hEdit, wcontent.c_str());
+            // an invalid cursor means the shown commit sits past the last one in the snapshot
+            CommitCursor moved = pContext->cursor;
+            if (moved.valid())
+                moved.prev();
+            else
+                moved.last();
+            if (moved.valid()) {
+                pContext->cursor = moved;
+                pContext->currentCommit = moved.commit();
+                showCommit(hDlg, pContext);
             }
             return TRUE;
         }
         case IDC_NEXT:
         {
-            auto succ = getSuccessor(g_commitTree, pContext->currentCommit, g_commitCounter - 1);
-            if (succ) {
-                pContext->currentCommit = succ->commitCounter;
-                std::wstring commitFileName = L"commit_" + std::to_wstring(pContext->currentCommit) + L".txt";
-                std::wstring fullPath = pContext->repoPath + L"\\" + commitFileName;
-                std::string fileContents = ReadFileAsString(fullPath);
-                int size_needed = MultiByteToWideChar(CP_UTF8, 0, fileContents.c_str(), -1, NULL, 0);
-                std::wstring wcontent(size_needed, 0);
-                MultiByteToWideChar(CP_UTF8, 0, fileContents.c_str(), -1, &wcontent[0], size_needed);
-                HWND hEdit = GetDlgItem(hDlg, IDC_VIEW_EDIT);
-                SetWindowText(hEdit, wcontent.c_str());
+            CommitCursor moved = pContext->cursor;
+            if (moved.valid() && moved.commit() == pContext->currentCommit)
+                moved.next();
+            if (moved.valid()) {
+                pContext->cursor = moved;
+                pContext->currentCommit = moved.commit();
+                showCommit(hDlg, pContext);
             }
             return TRUE;
         }
@@ -362,37 +647,40 @@ INT_PTR CALLBACK ViewOnlyDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM
                 L"Confirm Rollback", MB_YESNO | MB_ICONWARNING);
             if (confirm == IDYES) {
                 int rollbackCommit = pContext->currentCommit;
+                FileHistory& file = *pContext->file;
 
-                // Delete all commit files with commit numbers greater than the currently viewed commit.
-                for (int i = rollbackCommit + 1; i < g_commitCounter; i++) {
-                    std::wstring commitFileName = L"commit_" + std::to_wstring(i) + L".txt";
-                    std::wstring fullPath = g_repoPath + L"\\" + commitFileName;
-                    _wremove(fullPath.c_str());
-
-                    std::wstring diffFileName = L"commit_" + std::to_wstring(i) + L".diff";
-                    std::wstring diffFullPath = g_repoPath + L"\\" + diffFileName;
-                    _wremove(diffFullPath.c_str());
-
-                    std::wstring msgFileName = L"commit_" + std::to_wstring(i) + L".msg";
-                    std::wstring msgFullPath = g_repoPath + L"\\" + msgFileName;
-                    _wremove(msgFullPath.c_str());
+                // The text goes first. If it can't be rebuilt neither the pack nor the tree is touched.
+                if (!loadCommitText(file, rollbackCommit, pContext->textCache)) {
+                    MessageBox(hDlg, L"The text of this commit can't be rebuilt, objects of its history are missing or damaged. No commits were removed.",
+                        L"Rollback", MB_OK | MB_ICONERROR);
+                    return TRUE;
+                }
+                const std::string& rollbackText = pContext->textCache.text;
+
+                // The newer commits are cut off by a truncate record. Their texts stay in the pack,
+                // a later commit of the same text reuses them.
+                CommitInfo cut = CommitInfo();
+                cut.commitNumber = rollbackCommit;
+                if (!recordDelta(file, DELTA_TRUNCATE, cut, ContentHash())) {
+                    MessageBox(hDlg, L"Error writing the rollback, no commits were removed.", L"Rollback", MB_OK | MB_ICONERROR);
+                    return TRUE;
                 }
 
                 // Update the commit counter so that it is one more than the rollback commit.
-                g_commitCounter = rollbackCommit + 1;
+                file.commitCounter = rollbackCommit + 1;
+
+                // Cut the newer commits off the tree as a new version, no rescan of the repository.
+                file.repository.truncateAfter(rollbackCommit);
 
-                // Reinitialize the commit tree from the repository (only the remaining commits will be loaded).
-                InitializeCommitTree(g_repoPath);
+                // Nothing browses the discarded versions, only the new head stays in memory.
+                file.repository.compact(std::vector<int>());
 
                 // Load the rollback commit into Notepad++.
                 int which = -1;
                 ::SendMessage(nppData._nppHandle, NPPM_GETCURRENTSCINTILLA, 0, (LPARAM)&which);
                 if (which != -1) {
                     HWND curScintilla = (which == 0) ? nppData._scintillaMainHandle : nppData._scintillaSecondHandle;
-                    std::wstring commitFileName = L"commit_" + std::to_wstring(rollbackCommit) + L".txt";
-                    std::wstring fullPath = g_repoPath + L"\\" + commitFileName;
-                    std::string fileContents = ReadFileAsString(fullPath);
-                    ::SendMessage(curScintilla, SCI_SETTEXT, 0, (LPARAM)fileContents.c_str());
+                    ::SendMessage(curScintilla, SCI_SETTEXT, 0, (LPARAM)rollbackText.c_str());
                 }
 
                 if (g_hFileListDlg != NULL) {
@@ -402,6 +690,7 @@ INT_PTR CALLBACK ViewOnlyDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM
 
                 MessageBox(hDlg, L"Rollback successful.", L"Rollback", MB_OK);
                 EndDialog(hDlg, IDC_ROLLBACK);
+                delete pContext;
             }
             return TRUE;
         }
@@ -425,20 +714,17 @@ INT_PTR CALLBACK ViewOnlyDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM
 }
 
 
-// Function that handles view commits window
-void viewCommitInReadOnlyDialog(const std::wstring& fullPath)
+// Function that handles view commits window, opened on the commit the list had selected
+void viewCommitInReadOnlyDialog(FileHistory* file, int commitNum)
 {
-    size_t pos1 = fullPath.find(L"commit_");
-    if (pos1 == std::wstring::npos) return;
-    size_t pos2 = fullPath.find(L".txt", pos1);
-    if (pos2 == std::wstring::npos) return;
-    std::wstring numberStr = fullPath.substr(pos1 + 7, pos2 - (pos1 + 7));
-    int commitNum = _wtoi(numberStr.c_str());
-
     // Allocate and initialize the context.
     ViewCommitContext* pContext = new ViewCommitContext;
+    pContext->file = file;
     pContext->currentCommit = commitNum;
-    pContext->repoPath = g_repoPath;
+    pContext->snapshot = file->repository.snapshot();
+    pContext->cursor = pContext->snapshot->cursor();
+    pContext->cursor.seek(commitNum);
+    pContext->repoPath = file->folder;
 
     DialogBoxParam(
         g_hInst,
@@ -453,31 +739,21 @@ void viewCommitInReadOnlyDialog(const std::wstring& fullPath)
 // Lists out all commits in a summary view
 void openVersionedFile()
 {
-    // If no commits exist, notify the user.
-    if (!g_commitTree)
-    {
-        ::MessageBox(NULL, TEXT("No commits available."), TEXT("Info"), MB_OK);
-        return;
-    }
+    // Only the active document's history is listed.
+    FileHistory& file = loadedHistory();
 
-    // Build a vector of commit pairs (commit number and filename) by in-order traversal.
-    std::vector<CommitInfo> commitList;
-    for (int i = 1; i < g_commitCounter; i++) {
-        auto node = searchCommit(g_commitTree, i, g_commitCounter - 1);
-        if (node) {
-            commitList.push_back({ node->commitCounter, node->fileName, node->diffData, node->commitMessage });
-        }
-    }
-    if (commitList.empty())
+    // If no commits exist, notify the user.
+    std::shared_ptr<const CommitSnapshot> snapshot = file.repository.snapshot();
+    if (snapshot->empty())
     {
         ::MessageBox(NULL, TEXT("No commits available."), TEXT("Info"), MB_OK);
         return;
     }
 
-    // Prepare timeline data to pass to the dialog.
+    // Rows are looked up by position while the list is shown, nothing is copied up front.
     TimelineData timelineData;
-    timelineData.commits = commitList;
-    timelineData.folderPath = g_repoPath;
+    timelineData.file = &file;
+    timelineData.rows = CommitRows(snapshot);
 
     // Display the dialog
     DialogBoxParam(
@@ -519,7 +795,6 @@ void setRepoLocation()
     {
         g_repoPath = chosenFolder;
         SaveRepoPath(chosenFolder);
-        g_commitTree = nullptr;
         InitializeCommitTree(g_repoPath);
         std::wstring msg = L"Repository location set to:\n" + chosenFolder;
         ::MessageBox(NULL, msg.c_str(), L"Repository Location", MB_OK);
@@ -549,9 +824,16 @@ void commitCurrentFile() {
     std::string currentFileText(textBuffer, textLength);
     delete[] textBuffer;
 
-    // calculate the file names for the new and previous commit.
-    std::wstring commitFileName = L"commit_" + std::to_wstring(g_commitCounter) + L".txt";
-    std::wstring fullPath = g_repoPath + L"\\" + commitFileName;
+    // The commit goes into the active document's own history.
+    FileHistory& file = loadedHistory();
+    if (!file.pack.isOpen() && !createHistoryFolder(file))
+    {
+        ::MessageBox(NULL, TEXT("Error creating the history folder."), TEXT("Commit Error"), MB_OK);
+        return;
+    }
+
+    // The commit's name, the timeline lists it.
+    std::wstring commitFileName = L"commit_" + std::to_wstring(file.commitCounter) + L".txt";
 
     // handle commit message
     std::wstring commitMessage = promptForCommitMessage();
@@ -560,73 +842,92 @@ void commitCurrentFile() {
         return;
     }
 
+    // The text is stored under its hash. Text the previous commit already has is neither
+    // read back nor stored again, the commit is its record alone.
+    ContentHash blob = hashContent(currentFileText);
+    ContentHash previous;
+    bool hasPrevious = file.commitCounter > 1 && commitBlob(file, file.commitCounter - 1, previous);
+
     // Very basic diff generation (Will eventually replace this with an actual diffing library)
     std::wstring diffSummary = L"";
-    if (g_commitCounter > 1) {
-        std::wstring prevCommitFileName = L"commit_" + std::to_wstring(g_commitCounter - 1) + L".txt";
-        std::wstring prevFullPath = g_repoPath + L"\\" + prevCommitFileName;
-        std::string prevFileText = ReadFileAsString(prevFullPath);
-        diffSummary = computeDiffSummary(prevFileText, currentFileText);
+    CommitStats stats = CommitStats();
+    std::string prevFileText;
+    if (hasPrevious && memcmp(blob.bytes, previous.bytes, sizeof(blob.bytes)) == 0) {
+        diffSummary = computeDiffSummary(prevFileText, prevFileText, stats);
     }
-
-    FILE* fp = _wfopen(fullPath.c_str(), L"wb");
-    if (!fp) {
+    else if (file.commitCounter > 1) {
+        // a previous text that can't be rebuilt is no base for a delta
+        if (!readCommitText(file, file.commitCounter - 1, prevFileText))
+            hasPrevious = false;
+        diffSummary = computeDiffSummary(prevFileText, currentFileText, stats);
+    }
+    stats.bytes = (long long)currentFileText.size();
+
+    // A new text goes in as a delta from the previous one where that is smaller.
+    addTextBlob(file, blob, currentFileText, hasPrevious ? &previous : nullptr, prevFileText);
+
+    // Insert the new commit into the persistent AVL tree. Its time may be moved up to the
+    // previous commit's if the clock went back, what the tree recorded is what gets saved.
+    file.repository.insert(file.commitCounter, commitFileName, diffSummary, commitMessage, stats,
+        (long long)time(nullptr), currentUserName());
+    const CommitHistory& history = file.repository.history();
+    const CommitPayload& recorded = *history.search(file.commitCounter, history.latestVersion())->payload;
+
+    // The blob, summary, message, time and author go into the pack in one append.
+    if (!recordDelta(file, DELTA_COMMIT, { file.commitCounter, commitFileName, diffSummary, commitMessage, stats,
+        recorded.timestamp, recorded.author }, blob)) {
+        file.repository.truncateAfter(file.commitCounter - 1);
         ::MessageBox(NULL, TEXT("Error writing commit file."), TEXT("Commit Error"), MB_OK);
         return;
     }
-    fwrite(currentFileText.c_str(), sizeof(char), currentFileText.size(), fp);
-    fclose(fp);
+    file.commitCounter++;
 
-    // Create the diff file name (e.g., commit_3.diff) and full path.
-    std::wstring diffFileName = L"commit_" + std::to_wstring(g_commitCounter) + L".diff";
-    std::wstring diffFullPath = g_repoPath + L"\\" + diffFileName;
 
-    // Convert diffSummary (std::wstring) to a UTF-8 std::string.
-    int size_needed = WideCharToMultiByte(CP_UTF8, 0, diffSummary.c_str(), -1, nullptr, 0, nullptr, nullptr);
-    std::string diffSummaryStr(size_needed, 0);
-    WideCharToMultiByte(CP_UTF8, 0, diffSummary.c_str(), -1, &diffSummaryStr[0], size_needed, nullptr, nullptr);
+    std::wstring msg = L"File committed as " + commitFileName;
+    ::MessageBox(NULL, msg.c_str(), L"Commit Successful", MB_OK);
 
-    // Write the diff to the diff file.
-    FILE* diff_fp = _wfopen(diffFullPath.c_str(), L"wb");
-    if (diff_fp) {
-        fwrite(diffSummaryStr.c_str(), sizeof(char), diffSummaryStr.size(), diff_fp);
-        fclose(diff_fp);
-    }
-    else {
-        ::MessageBox(NULL, TEXT("Error writing diff file."), TEXT("Commit Error"), MB_OK);
-    }
+}
 
-    // Create a file name for the commit message, e.g., commit_3.msg:
-    std::wstring msgFileName = L"commit_" + std::to_wstring(g_commitCounter) + L".msg";
-    std::wstring msgFullPath = g_repoPath + L"\\" + msgFileName;
-    FILE* msg_fp = _wfopen(msgFullPath.c_str(), L"wb");
-    if (msg_fp) {
-        // Convert the commit message (std::wstring) to UTF-8 std::string
-        int msg_size_needed = WideCharToMultiByte(CP_UTF8, 0, commitMessage.c_str(), -1, nullptr, 0, nullptr, nullptr);
-        std::string commitMessageStr(msg_size_needed, 0);
-        WideCharToMultiByte(CP_UTF8, 0, commitMessage.c_str(), -1, &commitMessageStr[0], msg_size_needed, nullptr, nullptr);
 
-        // Write the commit message (without the null terminator)
-        fwrite(commitMessageStr.c_str(), sizeof(char), commitMessageStr.size() - 1, msg_fp);
-        fclose(msg_fp);
-    }
-    else {
-        ::MessageBox(NULL, TEXT("Error writing commit message file."), TEXT("Commit Error"), MB_OK);
+// Dumps what the active history takes in memory and the tree counters since startup.
+// The counters read zero in builds with MINIVC_NO_COUNTERS
+void showMemoryStatistics()
+{
+    FileHistory& file = loadedHistory();
+    const CommitHistory& history = file.repository.history();
+    MemoryReport report = history.memoryReport();
+    const TreeCounters& counters = treeCounters();
+
+    std::wostringstream out;
+    out.setf(std::ios::fixed);
+    out.precision(2);
+    out << L"History: " << (file.sourcePath.empty() ? L"unsaved buffer" : file.sourcePath.c_str()) << L"\n"
+        << L"Versions: " << report.versions << L"\n"
+        << L"Nodes: " << report.nodes << L" (" << report.nodeBytes << L" bytes)\n"
+        << L"Payloads: " << report.payloads << L" (" << report.payloadBytes << L" bytes)\n"
+        << L"Bytes per version: " << report.bytesPerVersion() << L"\n"
+        << L"Mod slots used per node: " << report.modSlotsPerNode() << L"\n"
+        << L"Arena: " << history.nodeArena().bytesInUse() << L" of " << history.nodeArena().bytesReserved() << L" bytes in use\n";
+    for (int used = 0; used <= 3 * CommitNode::MAX_MODS; used++) {
+        if (report.modSlots[used] != 0)
+            out << L"    " << used << L" slots: " << report.modSlots[used] << L" nodes\n";
     }
 
-    // Insert the new commit into the persistent AVL tree
-    g_commitTree = insertNode(g_commitTree, g_commitCounter, commitFileName, diffSummary, commitMessage);
-    g_commitCounter++;
-
-
-    std::wstring msg = L"File committed as " + commitFileName;
-    ::MessageBox(NULL, msg.c_str(), L"Commit Successful", MB_OK);
-
+    out << L"\nAll histories since startup\n"
+        << L"Nodes allocated: " << counters.nodesAllocated << L", live: " << counters.nodesAllocated - counters.nodesFreed << L"\n"
+        << L"Full node copies: " << counters.nodeCopies << L"\n"
+        << L"Mods logged: " << counters.modsLogged << L"\n"
+        << L"Payloads created: " << counters.payloadsCreated << L" (" << counters.payloadBytes << L" bytes), copied: "
+        << counters.payloadCopies << L"\n"
+        << L"Inserts: " << counters.inserts << L", rotations: " << counters.rotations;
+    if (counters.inserts != 0)
+        out << L" (" << (double)counters.rotations / counters.inserts << L" per insert)";
+    ::MessageBox(nppData._nppHandle, out.str().c_str(), L"Memory Statistics", MB_OK);
 }
 
 
 // Basic function for generating a diff summary, will eventually replace this with actual diffing
-std::wstring computeDiffSummary(const std::string& oldText, const std::string& newText) {
+std::wstring computeDiffSummary(const std::string& oldText, const std::string& newText, CommitStats& stats) {
     std::istringstream oldStream(oldText);
     std::istringstream newStream(newText);
     std::string oldLine, newLine;
@@ -643,51 +944,373 @@ std::wstring computeDiffSummary(const std::string& oldText, const std::string& n
     while (std::getline(oldStream, oldLine)) removed++;
     while (std::getline(newStream, newLine)) added++;
 
+    stats.linesAdded = added;
+    stats.linesRemoved = removed;
+
     std::wstringstream wss;
     wss << L"Added: " << added << L", Removed: " << removed;
     return wss.str();
 }
 
 
-// Parse the repo folder and populate the commit tree for the current Notepad++ session
-void InitializeCommitTree(const std::wstring& repoFolder)
+// Reads the line counts back out of a summary written by computeDiffSummary
+CommitStats parseDiffSummary(const std::wstring& diffSummary) {
+    CommitStats stats = CommitStats();
+    long long added = 0, removed = 0;
+    if (swscanf(diffSummary.c_str(), L"Added: %lld, Removed: %lld", &added, &removed) == 2) {
+        stats.linesAdded = added;
+        stats.linesRemoved = removed;
+    }
+    return stats;
+}
+
+
+// The image holds the tree as of the last fold, the pack's records after what objects.idx
+// covers every change made since.
+const int DELTA_FOLD_RECORDS = 256;
+
+std::wstring imagePath(const std::wstring& repoFolder) { return repoFolder + L"\\minivc.img"; }
+
+
+// Writes the file's current tree out as its new image, then the pack index as of the same point.
+void foldDeltaLog(FileHistory& file)
 {
-    // Get all text files from the repo folder.
-    std::vector<std::wstring> files = GetTextFiles(repoFolder);
-    int maxCommit = 0;
+    if (file.deltaRecords == 0)
+        return;
+    if (writeCommitImage(file.repository.history(), imagePath(file.folder))) {
+        file.pack.writeIndex(packIndexPath(file.folder));
+        file.deltaRecords = 0;
+    }
+}
 
-    // Iterate through each file.
-    for (const auto& file : files)
+
+// Appends a change to the pack, together with any blob queued for it, and folds once enough
+// have piled up. False if the write failed, the change is then not saved.
+bool recordDelta(FileHistory& file, uint32_t type, const CommitInfo& commit, const ContentHash& blob)
+{
+    file.pack.addRecord(type, commit, blob);
+    if (!file.pack.flush())
+        return false;
+    if (++file.deltaRecords >= DELTA_FOLD_RECORDS)
+        foldDeltaLog(file);
+    return true;
+}
+
+
+// Sets the file's commit counter to one more than its highest commit number.
+void updateCommitCounter(FileHistory& file)
+{
+    CommitCursor last = file.repository.history().cursor(file.repository.history().latestVersion());
+    last.last();
+    file.commitCounter = last.valid() ? last.commit() + 1 : 1;
+}
+
+
+// Commits of a history from before the object pack, found by the names of their commit_N.txt
+// files. In commit order.
+std::vector<CommitInfo> scanCommitFiles(const std::wstring& folder)
+{
+    std::vector<long long> fileBytes, writeTimes;
+    std::vector<std::wstring> files = GetTextFiles(folder, &fileBytes, &writeTimes);
+    std::map<int, size_t> found;     // Commit number to its text file.
+
+    // Check if file name matches the pattern "commit_<number>.txt"
+    std::wstring prefix = L"commit_";
+    std::wstring suffix = L".txt";
+    for (size_t i = 0; i < files.size(); i++)
     {
-        // Check if file name matches the pattern "commit_<number>.txt"
-        std::wstring prefix = L"commit_";
-        std::wstring suffix = L".txt";
-        if (file.compare(0, prefix.size(), prefix) == 0 &&
-            file.size() > prefix.size() + suffix.size() &&
-            file.compare(file.size() - suffix.size(), suffix.size(), suffix) == 0)
+        const std::wstring& fileName = files[i];
+        if (fileName.compare(0, prefix.size(), prefix) == 0 &&
+            fileName.size() > prefix.size() + suffix.size() &&
+            fileName.compare(fileName.size() - suffix.size(), suffix.size(), suffix) == 0)
         {
-            std::wstring numStr = file.substr(prefix.size(), file.size() - prefix.size() - suffix.size());
-            int commitNum = _wtoi(numStr.c_str());
+            std::wstring numStr = fileName.substr(prefix.size(), fileName.size() - prefix.size() - suffix.size());
+            found.insert({ _wtoi(numStr.c_str()), i });
+        }
+    }
+
+    std::vector<CommitInfo> commits;
+    for (const auto& entry : found)
+    {
+        int commitNum = entry.first;
+        size_t i = entry.second;
+        std::wstring name = L"commit_" + std::to_wstring(commitNum) + L".txt";
+
+        std::wstring diffFileName = L"commit_" + std::to_wstring(commitNum) + L".diff";
+        std::wstring diffFullPath = folder + L"\\" + diffFileName;
+        std::string diffDataStr;
+        readFile(diffFullPath, diffDataStr);
+        std::wstring diffData(diffDataStr.begin(), diffDataStr.end());
+
+        std::wstring msgFileName = L"commit_" + std::to_wstring(commitNum) + L".msg";
+        std::wstring msgFullPath = folder + L"\\" + msgFileName;
+        std::string commitMsgStr;
+        readFile(msgFullPath, commitMsgStr);
+        std::wstring commitMsg(commitMsgStr.begin(), commitMsgStr.end());
+
+        // Stats are rebuilt from the summary and the text size, the time is the file's, the author unknown.
+        CommitStats stats = parseDiffSummary(diffData);
+        stats.bytes = fileBytes[i];
+        commits.push_back({ commitNum, name, diffData, commitMsg, stats, writeTimes[i], L"" });
+    }
+    return commits;
+}
+
+
+// Moves the commits of a history from before the object pack into its new pack, each flushed
+// as it goes. Oldest first, so each text goes in as a delta from the one before it, the way
+// new commits do. The old files are left where they are.
+void importCommitFiles(FileHistory& file)
+{
+    std::vector<CommitInfo> commits = scanCommitFiles(file.folder);
+    CommitTextCache cache;
+    ContentHash previous;
+    std::string previousText;
+    bool first = true;
+    for (const CommitInfo& commit : commits) {
+        if (!readCommitFiles(file.folder, commit.commitNumber, cache)) {
+            // kept without a text rather than with an empty one, the viewer says it can't be rebuilt
+            file.pack.addRecord(DELTA_COMMIT, commit, ContentHash());
+            if (!file.pack.flush())
+                return;
+            continue;
+        }
+        ContentHash blob = hashContent(cache.text);
+        addTextBlob(file, blob, cache.text, first ? nullptr : &previous, previousText);
+        file.pack.addRecord(DELTA_COMMIT, commit, blob);
+        if (!file.pack.flush())
+            return;
+        previous = blob;
+        previousText.swap(cache.text);
+        first = false;
+    }
+    file.pack.writeIndex(packIndexPath(file.folder));
+}
+
+
+// Makes the folder of a history that has none yet and opens its new pack. The first commit
+// does this, a document that was only looked at leaves nothing behind.
+bool createHistoryFolder(FileHistory& file)
+{
+    CreateDirectoryW(file.folder.c_str(), NULL);
+
+    // The folder names its document, the path is readable without the plugin.
+    if (!file.sourcePath.empty()) {
+        FILE* fp = _wfopen((file.folder + L"\\source.path").c_str(), L"w");
+        if (fp) {
+            fputws(file.sourcePath.c_str(), fp);
+            fclose(fp);
+        }
+    }
+    bool created;
+    return file.pack.open(packPath(file.folder), packIndexPath(file.folder), created);
+}
+
 
-            std::wstring diffFileName = L"commit_" + std::to_wstring(commitNum) + L".diff";
-            std::wstring diffFullPath = repoFolder + L"\\" + diffFileName;
-            std::string diffDataStr = ReadFileAsString(diffFullPath);
-            std::wstring diffData(diffDataStr.begin(), diffDataStr.end());
+// Commits made before histories were kept per file are in the repository root, with nothing
+// saying which document they belong to. The first document without a history of its own that
+// is opened asks whether they are its own and, if so, gets a copy of them in its new folder.
+// root.path records the document that took them, the root itself is left as it was.
+std::wstring rootClaimPath() { return g_repoPath + L"\\root.path"; }
 
-            std::wstring msgFileName = L"commit_" + std::to_wstring(commitNum) + L".msg";
-            std::wstring msgFullPath = repoFolder + L"\\" + msgFileName;
-            std::string commitMsgStr = ReadFileAsString(msgFullPath);
-            std::wstring commitMsg(commitMsgStr.begin(), commitMsgStr.end());
+bool adoptRootCommits(FileHistory& file)
+{
+    if (GetFileAttributesW(rootClaimPath().c_str()) != INVALID_FILE_ATTRIBUTES)
+        return false;
+
+    // a root that never had a commit is left alone, reading it would create its pack
+    WIN32_FIND_DATA findFileData;
+    HANDLE hFind = FindFirstFile((g_repoPath + L"\\commit_*.txt").c_str(), &findFileData);
+    if (hFind != INVALID_HANDLE_VALUE)
+        FindClose(hFind);
+    else if (GetFileAttributesW(packPath(g_repoPath).c_str()) == INVALID_FILE_ATTRIBUTES)
+        return false;
 
-            // Insert into commit tree
-            g_commitTree = insertNode(g_commitTree, commitNum, file, diffData, commitMsg);
+    FileHistory& root = historyFor(L"");
+    if (!root.loaded)
+        loadHistory(root);
+    std::shared_ptr<const CommitSnapshot> snapshot = root.repository.snapshot();
+    if (snapshot->empty())
+        return false;
 
-            if (commitNum > maxCommit)
-                maxCommit = commitNum;
+    size_t slash = file.sourcePath.find_last_of(L"\\/");
+    std::wstring question = L"The repository holds " + std::to_wstring(snapshot->size())
+        + L" commits made before each file kept its own history.\nAre they commits of "
+        + file.sourcePath.substr(slash + 1) + L"?";
+    if (::MessageBox(nppData._nppHandle, question.c_str(), L"Earlier Commits", MB_YESNO) != IDYES)
+        return false;
+    if (!createHistoryFolder(file))
+        return false;
+
+    // Oldest first, each text a delta from the one before it, each commit flushed as it goes.
+    CommitTextCache cache;
+    ContentHash previous;
+    std::string previousText;
+    bool first = true;
+    for (CommitCursor c = snapshot->cursor(); c.valid(); c.next()) {
+        const CommitNode& node = c.node();
+        if (!loadCommitText(root, node.commitCounter, cache)) {
+            std::wstring msg = L"Commit " + std::to_wstring(node.commitCounter)
+                + L" can't be rebuilt, only the commits before it were copied.";
+            ::MessageBox(nppData._nppHandle, msg.c_str(), L"Earlier Commits", MB_OK | MB_ICONERROR);
+            break;
         }
+        const std::string& text = cache.text;
+        ContentHash blob = hashContent(text);
+        addTextBlob(file, blob, text, first ? nullptr : &previous, previousText);
+        file.pack.addRecord(DELTA_COMMIT, { node.commitCounter, node.payload->fileName, node.payload->diffData,
+            node.payload->commitMessage, node.payload->stats, node.payload->timestamp, node.payload->author }, blob);
+        if (!file.pack.flush())
+            break;
+        previous = blob;
+        previousText = text;
+        first = false;
+    }
+    file.pack.close();
+
+    FILE* fp = _wfopen(rootClaimPath().c_str(), L"w");
+    if (fp) {
+        fputws(file.sourcePath.c_str(), fp);
+        fclose(fp);
     }
-    // Set the global commit counter to one more than the highest commit number.
-    g_commitCounter = maxCommit + 1;
+    return true;
+}
+
+
+// Populate a file's commit tree from its folder, the first time its commits are needed
+void loadHistory(FileHistory& file)
+{
+    file.loaded = true;
+    // Nothing committed yet, unless the commits in the root turn out to be this document's
+    if (GetFileAttributesW(file.folder.c_str()) == INVALID_FILE_ATTRIBUTES
+        && (file.sourcePath.empty() || !adoptRootCommits(file)))
+        return;
+
+    bool created = false;
+    if (file.pack.open(packPath(file.folder), packIndexPath(file.folder), created) && created)
+        importCommitFiles(file);
+    size_t replayed = 0;
+    if (loadCommitImage(file.repository, file.pack, imagePath(file.folder), replayed)) {
+        file.deltaRecords = (int)replayed;
+        updateCommitCounter(file);
+        return;
+    }
+
+    // Without an image the pack's records are the history. A folder the pack can't be created
+    // in is read from its commit files as it is.
+    std::map<int, CommitInfo> live;
+    if (!file.pack.isOpen()) {
+        for (CommitInfo& commit : scanCommitFiles(file.folder))
+            live[commit.commitNumber] = std::move(commit);
+    }
+    loadPackRecords(file.repository, file.pack, std::move(live));
+    updateCommitCounter(file);
+
+    // Next start maps this instead of reading the whole pack again.
+    if (writeCommitImage(file.repository.history(), imagePath(file.folder)))
+        file.pack.writeIndex(packIndexPath(file.folder));
+}
+
+
+// Folder of a document's history: its name plus a hash of its full path, so two files with the
+// same name in different places never share one. An unsaved buffer, named without a path, gets
+// unsaved_ and a hash of its name. The empty name is the repository root, which only ever holds
+// the commits made before histories were kept per file (see adoptRootCommits). Nothing is
+// created, see createHistoryFolder.
+std::wstring historyFolder(const std::wstring& document)
+{
+    if (document.empty())
+        return g_repoPath;
+
+    // FNV-1a over the lower-cased path, Windows paths are not case sensitive
+    unsigned int hash = 2166136261u;
+    for (wchar_t ch : document) {
+        hash ^= (unsigned int)towlower(ch);
+        hash *= 16777619u;
+    }
+    wchar_t suffix[16] = { 0 };
+    swprintf(suffix, 16, L"_%08x", hash);
+    size_t slash = document.find_last_of(L"\\/");
+    if (slash == std::wstring::npos)
+        return g_repoPath + L"\\unsaved" + suffix;
+    return g_repoPath + L"\\" + document.substr(slash + 1) + suffix;
+}
+
+
+// History of a document, by its full path or an unsaved buffer's name, registered the first
+// time it is asked for but not read yet
+FileHistory& historyFor(const std::wstring& document)
+{
+    std::wstring key = document;
+    for (wchar_t& ch : key)
+        ch = (wchar_t)towlower(ch);
+    auto found = g_histories.find(key);
+    if (found == g_histories.end()) {
+        std::unique_ptr<FileHistory> file(new FileHistory);
+        file->sourcePath = document.find_first_of(L"\\/") == std::wstring::npos ? std::wstring() : document;
+        file->folder = historyFolder(document);
+        found = g_histories.insert(std::make_pair(key, std::move(file))).first;
+    }
+    return *found->second;
+}
+
+
+// History of the document in the active buffer. Only resolved here, nothing on disk is
+// touched until its commits are needed, see loadedHistory.
+FileHistory& activeHistory()
+{
+    wchar_t path[MAX_PATH] = { 0 };
+    ::SendMessage(nppData._nppHandle, NPPM_GETFULLCURRENTPATH, MAX_PATH, (LPARAM)path);
+    // "new 1" and the like have not been saved anywhere yet, their name has no path in it
+    g_active = &historyFor(path[0] ? path : L"new");
+    return *g_active;
+}
+
+
+// History of the active document with its commits read. Only that document's folder is read,
+// other files' commits are never looked at.
+FileHistory& loadedHistory()
+{
+    FileHistory& file = activeHistory();
+    if (!file.loaded)
+        loadHistory(file);
+    return file;
+}
+
+
+// Switches to the new buffer's history as soon as Notepad++ activates it, without reading it.
+void activateBuffer()
+{
+    activeHistory();
+}
+
+
+// Folds every history's changes into its image and lets go of all histories. Each one's arena goes back in one
+// piece once no snapshot of it is held.
+void closeHistories()
+{
+    for (auto& entry : g_histories) {
+        foldDeltaLog(*entry.second);
+        entry.second->pack.close();
+        entry.second->repository.reset();
+        g_closedHistories.push_back(std::move(entry.second));
+    }
+    g_histories.clear();
+    g_active = nullptr;
+
+    size_t waiting = 0;
+    for (auto& closed : g_closedHistories)
+        waiting += closed->repository.reclaim();
+    if (waiting == 0)
+        g_closedHistories.clear();
+}
+
+
+// Opens the repository at repoFolder. Histories are loaded per document when it becomes active
+void InitializeCommitTree(const std::wstring& repoFolder)
+{
+    closeHistories();
+    g_repoPath = repoFolder;
 }
 
 
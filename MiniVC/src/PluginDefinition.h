@@ -36,7 +36,7 @@ const TCHAR NPP_PLUGIN_NAME[] = TEXT("MiniVC");
 //
 // Here define the number of your plugin commands
 //
-const int nbFunc = 3;
+const int nbFunc = 4;
 
 
 //
@@ -66,6 +66,11 @@ void commandMenuCleanUp();
 //
 bool setCommand(size_t index, TCHAR* cmdName, PFUNCPLUGINCMD pFunc, ShortcutKey* sk = NULL, bool check0nInit = false);
 
+//
+// Switch to the history of the buffer Notepad++ just activated
+//
+void activateBuffer();
+
 
 //
 // Your plugin command functions
@@ -73,5 +78,6 @@ bool setCommand(size_t index, TCHAR* cmdName, PFUNCPLUGINCMD pFunc, ShortcutKey*
 void openVersionedFile();
 void setRepoLocation();
 void commitCurrentFile();
+void showMemoryStatistics();
 
 #endif //PLUGINDEFINITION_H